@@ -0,0 +1,209 @@
+#include "CommandBuffer.h"
+#include "ECS_Core.h"
+#include "Misc/ScopeLock.h"
+#include <atomic>
+
+DECLARE_CYCLE_STAT(TEXT("ECS: Apply Commands"), STAT_ApplyCommands, STATGROUP_ECS);
+DECLARE_CYCLE_STAT(TEXT("ECS: Apply Destroys"), STAT_ApplyDestroys, STATGROUP_ECS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("ECS: Destroyed Entities"), STAT_DestroyedEntities, STATGROUP_ECS);
+
+//every queue gets a serial that is never reused, so a thread cant pick up the buffer of a queue that was destroyed
+static std::atomic<uint64> NextQueueSerial{ 1 };
+
+struct ThreadBufferCache {
+	uint64 serial;
+	ECSCommandBuffer* buffer;
+};
+static thread_local ThreadBufferCache ThreadBuffer{ 0, nullptr };
+
+ECSCommandBuffer::~ECSCommandBuffer()
+{
+	Reset();
+}
+
+ECSDeferredEntity ECSCommandBuffer::Create()
+{
+	return ECSDeferredEntity{ numCreated++ };
+}
+
+void ECSCommandBuffer::Destroy(ECSCommandTarget target)
+{
+	destroys.Add(target);
+}
+
+void ECSCommandBuffer::Call(TFunction<void(flecs::world&)>&& function)
+{
+	calls.Add(MoveTemp(function));
+}
+
+void ECSCommandBuffer::Reset()
+{
+	for (const Command& c : commands) {
+		if (c.type == ECommandType::Set) {
+			c.component->Destruct(payload.GetData() + c.offset);
+		}
+	}
+	commands.Reset();
+	destroys.Reset();
+	calls.Reset();
+	payload.Reset();
+	created.Reset();
+	numCreated = 0;
+}
+
+ECSCommandQueue::ECSCommandQueue()
+{
+	serial = NextQueueSerial++;
+}
+
+ECSCommandQueue::~ECSCommandQueue()
+{
+	for (auto& b : buffers) {
+		delete b.Value;
+	}
+}
+
+ECSCommandBuffer& ECSCommandQueue::GetThreadBuffer()
+{
+	check(!bApplying);
+
+	if (ThreadBuffer.serial == serial) {
+		return *ThreadBuffer.buffer;
+	}
+
+	//only the first use on each thread gets here
+	const uint32 threadId = FPlatformTLS::GetCurrentThreadId();
+	FScopeLock lock(&buffersLock);
+
+	ECSCommandBuffer* buffer = nullptr;
+	for (auto& b : buffers) {
+		if (b.Key == threadId) {
+			buffer = b.Value;
+			break;
+		}
+	}
+	if (!buffer) {
+		buffer = new ECSCommandBuffer();
+		buffers.Add({ threadId, buffer });
+	}
+
+	ThreadBuffer.serial = serial;
+	ThreadBuffer.buffer = buffer;
+	return *buffer;
+}
+
+void ECSCommandQueue::Apply(flecs::world& reg)
+{
+	SCOPE_CYCLE_COUNTER(STAT_ApplyCommands);
+
+	ecs_world_t* world = reg.c_ptr();
+	TGuardValue<bool> applyGuard(bApplying, true);
+
+	struct PendingCommand {
+		UPTRINT table;
+		flecs::entity_t entity;
+		int32 order;
+		const ECSCommandBuffer::Command* command;
+		ECSCommandBuffer* buffer;
+	};
+	TArray<PendingCommand> pending;
+
+	for (auto& b : buffers) {
+		ECSCommandBuffer* buffer = b.Value;
+		if (buffer->IsEmpty()) continue;
+
+		//new entities first, so every command can resolve its target
+		buffer->created.SetNumUninitialized(buffer->numCreated);
+		for (int32 i = 0; i < buffer->numCreated; i++) {
+			buffer->created[i] = ecs_new(world, 0);
+		}
+
+		for (const auto& c : buffer->commands) {
+			const flecs::entity_t entity = buffer->Resolve(c.target);
+			pending.Add({ (UPTRINT)ecs_get_type(world, entity), entity, pending.Num(), &c, buffer });
+		}
+	}
+
+	//the same change on the entities of the same table moves them all to the same table, so those commands run one after another.
+	//Commands on different components of an entity give the same result in any order, so an entity created with several sets
+	//goes through its tables one component at a time together with the other new entities, instead of entity by entity.
+	//Commands on the same component of an entity keep the order they were recorded in
+	pending.Sort([](const PendingCommand& A, const PendingCommand& B) {
+		if (A.table != B.table) return A.table < B.table;
+		if (A.command->component != B.command->component) return A.command->component < B.command->component;
+		if (A.entity != B.entity) return A.entity < B.entity;
+		return A.order < B.order;
+	});
+
+	for (const PendingCommand& p : pending) {
+		const ECSCommandBuffer::Command& c = *p.command;
+		switch (c.type) {
+		case ECSCommandBuffer::ECommandType::Add:
+			c.component->Add(reg, p.entity);
+			break;
+		case ECSCommandBuffer::ECommandType::Remove:
+			c.component->Remove(reg, p.entity);
+			break;
+		case ECSCommandBuffer::ECommandType::Set:
+			c.component->Set(reg, p.entity, p.buffer->payload.GetData() + c.offset);
+			break;
+		}
+	}
+
+	for (auto& b : buffers) {
+		for (auto& call : b.Value->calls) {
+			call(reg);
+		}
+	}
+
+	ApplyDestroys(world);
+
+	for (auto& b : buffers) {
+		b.Value->Reset();
+	}
+}
+
+void ECSCommandQueue::ApplyDestroys(ecs_world_t* world)
+{
+	SCOPE_CYCLE_COUNTER(STAT_ApplyDestroys);
+
+	struct PendingDestroy {
+		UPTRINT table;
+		int32 row;
+		flecs::entity_t entity;
+	};
+	TArray<PendingDestroy> destroys;
+
+	for (auto& b : buffers) {
+		for (const auto& target : b.Value->destroys) {
+			const flecs::entity_t entity = b.Value->Resolve(target);
+			if (!ecs_is_alive(world, entity)) continue;
+
+			//the sign of the record row only flags watched entities
+			const ecs_record_t* record = ecs_record_find(world, entity);
+			const int32 row = record ? FMath::Abs(record->row) - 1 : INDEX_NONE;
+			destroys.Add({ record ? (UPTRINT)record->table : 0, row, entity });
+		}
+	}
+
+	//an entity can be destroyed by more than one thread, the copies end up next to each other.
+	//The rows of a table go from the last one down, so the rows at the end of the table are dropped without moving anything,
+	//and the rows that fill the holes are ones that stay
+	destroys.Sort([](const PendingDestroy& A, const PendingDestroy& B) {
+		if (A.table != B.table) return A.table < B.table;
+		if (A.row != B.row) return A.row > B.row;
+		return A.entity < B.entity;
+	});
+
+	int32 numDestroyed = 0;
+	flecs::entity_t last = 0;
+	for (const PendingDestroy& d : destroys) {
+		//deleting an entity can take its children with it
+		if (d.entity != last && ecs_is_alive(world, d.entity)) {
+			ecs_delete(world, d.entity);
+			numDestroyed++;
+		}
+		last = d.entity;
+	}
+	INC_DWORD_STAT_BY(STAT_DestroyedEntities, numDestroyed);
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "flecs/flecs.h"
+#include "HAL/CriticalSection.h"
+
+//entity created by a command buffer. Only means something to the buffer that created it, until the commands are applied
+struct ECSDeferredEntity {
+	int32 index{ INDEX_NONE };
+};
+
+//entity a command applies to, either one that exists or one created earlier in the same buffer
+struct ECSCommandTarget {
+	ECSCommandTarget(flecs::entity_t _entity) : entity(_entity) {}
+	ECSCommandTarget(ECSDeferredEntity _deferred) : deferred(_deferred.index) {}
+
+	flecs::entity_t entity{ 0 };
+	int32 deferred{ INDEX_NONE };
+};
+
+//type erased operations on one component type, so the commands can store values of any component
+struct ECSCommandComponent {
+	void(*Add)(flecs::world& reg, flecs::entity_t entity);
+	void(*Remove)(flecs::world& reg, flecs::entity_t entity);
+	void(*Set)(flecs::world& reg, flecs::entity_t entity, void* value);
+	void(*Destruct)(void* value);
+
+	template<typename T>
+	static const ECSCommandComponent* Get() {
+		static const ECSCommandComponent ops{
+			[](flecs::world& reg, flecs::entity_t entity) { flecs::entity(reg, entity).add<T>(); },
+			[](flecs::world& reg, flecs::entity_t entity) { flecs::entity(reg, entity).remove<T>(); },
+			[](flecs::world& reg, flecs::entity_t entity, void* value) { flecs::entity(reg, entity).set<T>(*static_cast<T*>(value)); },
+			[](void* value) { static_cast<T*>(value)->~T(); }
+		};
+		return &ops;
+	}
+};
+
+//Structural changes recorded by a single thread. Nothing touches the registry until the queue that owns the buffer applies it,
+//so a task can record changes to the tables it is iterating.
+class ECSCommandBuffer {
+public:
+	~ECSCommandBuffer();
+
+	ECSDeferredEntity Create();
+	void Destroy(ECSCommandTarget target);
+
+	template<typename T>
+	void Add(ECSCommandTarget target) {
+		Record(ECommandType::Add, target, ECSCommandComponent::Get<T>(), INDEX_NONE);
+	}
+
+	template<typename T>
+	void Remove(ECSCommandTarget target) {
+		Record(ECommandType::Remove, target, ECSCommandComponent::Get<T>(), INDEX_NONE);
+	}
+
+	template<typename T>
+	void Set(ECSCommandTarget target, const T& value) {
+		static_assert(alignof(T) <= PayloadAlignment, "component alignment too big for the command payload");
+
+		const int32 offset = Align(payload.Num(), alignof(T));
+		payload.SetNumUninitialized(offset + sizeof(T));
+		new (payload.GetData() + offset) T(value);
+
+		Record(ECommandType::Set, target, ECSCommandComponent::Get<T>(), offset);
+	}
+
+	//runs on the game thread when the commands are applied, after every component change and before the destroys
+	void Call(TFunction<void(flecs::world&)>&& function);
+
+	bool IsEmpty() const {
+		return commands.Num() == 0 && calls.Num() == 0 && destroys.Num() == 0 && numCreated == 0;
+	}
+
+private:
+	friend class ECSCommandQueue;
+
+	static constexpr int32 PayloadAlignment = 16;
+
+	enum class ECommandType : uint8 {
+		Add,
+		Remove,
+		Set
+	};
+
+	struct Command {
+		ECSCommandTarget target;
+		const ECSCommandComponent* component;
+		//offset of the value in the payload, only for Set
+		int32 offset;
+		ECommandType type;
+	};
+
+	void Record(ECommandType type, ECSCommandTarget target, const ECSCommandComponent* component, int32 offset) {
+		commands.Add({ target, component, offset, type });
+	}
+
+	flecs::entity_t Resolve(const ECSCommandTarget& target) const {
+		return target.deferred != INDEX_NONE ? created[target.deferred] : target.entity;
+	}
+
+	//destroys the payload values and empties the buffer
+	void Reset();
+
+	TArray<Command> commands;
+	TArray<ECSCommandTarget> destroys;
+	TArray<TFunction<void(flecs::world&)>> calls;
+	TArray<uint8, TAlignedHeapAllocator<PayloadAlignment>> payload;
+
+	int32 numCreated{ 0 };
+	//ids of the deferred entities, filled in when the buffer is applied
+	TArray<flecs::entity_t> created;
+};
+
+//Owns one command buffer per thread that records into it. Apply is the merge point: it runs the commands of every buffer,
+//grouped by the table the entity is in and then by component, so the moves between two tables happen together.
+//It has to be called while no task is running.
+//Commands on the same component of an entity keep the order they were recorded in as long as they come from the same thread.
+class ECSCommandQueue {
+public:
+	ECSCommandQueue();
+	~ECSCommandQueue();
+
+	//buffer of the calling thread, created the first time a thread asks for it. Not allowed while the commands are being applied
+	ECSCommandBuffer& GetThreadBuffer();
+
+	void Apply(flecs::world& reg);
+
+private:
+	//destroys the entities of every buffer once each, table by table
+	void ApplyDestroys(ecs_world_t* world);
+
+	uint64 serial;
+	bool bApplying{ false };
+
+	FCriticalSection buffersLock;
+	TArray<TPair<uint32, ECSCommandBuffer*>> buffers;
+};
@@ -15,7 +15,98 @@ AECS_Archetype::AECS_Archetype()
 
 EntityHandle AECS_Archetype::CreateNewEntityFromThis(ECS_World * _ECS)
 {
-	EntityHandle h = _ECS->NewEntity();
+	EntityHandle h;
+	h.handle = *SpawnEntitiesFromThis(_ECS, 1);
+	return h;
+}
+
+const EntityID* AECS_Archetype::SpawnEntitiesFromThis(ECS_World* _ECS, int32 count, TArrayView<const ECSSpawnColumn> columns)
+{
+	if (count <= 0)
+	{
+		return nullptr;
+	}
+	if (PrefabWorld != _ECS)
+	{
+		CompilePrefab(_ECS);
+	}
+
+	ecs_world_t* world = _ECS->GetRegistry()->c_ptr();
+
+	struct SpawnColumn {
+		ecs_entity_t id;
+		int32 size;
+		const void* values;
+		//a default from the prefab, it has to be repeated for every entity
+		bool bRepeat;
+	};
+
+	TArray<SpawnColumn, TInlineAllocator<16>> spawnColumns;
+	for (const PrefabComponent& c : PrefabComponents)
+	{
+		const void* value = c.size > 0 ? ecs_get_w_entity(world, Prefab, c.id) : nullptr;
+		spawnColumns.Add({ c.id, c.size, value, true });
+	}
+	for (const ECSSpawnColumn& c : columns)
+	{
+		SpawnColumn* existing = spawnColumns.FindByPredicate([&](const SpawnColumn& s) { return s.id == c.component; });
+		if (existing)
+		{
+			existing->values = c.values;
+			existing->bRepeat = false;
+		}
+		else
+		{
+			spawnColumns.Add({ c.component, c.size, c.values, false });
+		}
+	}
+
+	//flecs reads the data arrays in the order of the table columns
+	spawnColumns.Sort([](const SpawnColumn& A, const SpawnColumn& B) { return A.id < B.id; });
+
+	int32 repeatedBytes = 0;
+	for (const SpawnColumn& c : spawnColumns)
+	{
+		if (c.bRepeat && c.values)
+		{
+			repeatedBytes += Align(c.size * count, 16);
+		}
+	}
+	SpawnData.SetNumUninitialized(repeatedBytes, false);
+
+	//components are plain data, so the defaults can be repeated with a memcpy. flecs copies them into the table after that
+	TArray<ecs_entity_t, TInlineAllocator<16>> ids;
+	TArray<void*, TInlineAllocator<16>> data;
+	uint8* cursor = SpawnData.GetData();
+	for (const SpawnColumn& c : spawnColumns)
+	{
+		ids.Add(c.id);
+		if (c.bRepeat && c.values)
+		{
+			for (int32 i = 0; i < count; i++)
+			{
+				FMemory::Memcpy(cursor + i * c.size, c.values, c.size);
+			}
+			data.Add(cursor);
+			cursor += Align(c.size * count, 16);
+		}
+		else
+		{
+			data.Add(const_cast<void*>(c.values));
+		}
+	}
+
+	ecs_entities_t components{ ids.GetData(), ids.Num() };
+	return ecs_bulk_new_w_data(world, count, &components, data.GetData());
+}
+
+void AECS_Archetype::CompilePrefab(ECS_World* _ECS)
+{
+	ecs_world_t* world = _ECS->GetRegistry()->c_ptr();
+
+	//the prefab tag keeps the entity out of every query
+	EntityHandle h;
+	h.handle = ecs_new_w_entity(world, EcsPrefab);
 
 	for (auto c : GetComponents())
 	{
@@ -26,6 +117,22 @@ EntityHandle AECS_Archetype::CreateNewEntityFromThis(ECS_World * _ECS)
 		}
 	}
 
-	return h;
+	Prefab = h.handle;
+	PrefabWorld = _ECS;
+	PrefabComponents.Reset();
+
+	ecs_type_t type = ecs_get_type(world, Prefab);
+	const ecs_entity_t* typeIds = ecs_vector_first(type, ecs_entity_t);
+	for (int32 i = 0; i < ecs_vector_count(type); i++)
+	{
+		const ecs_entity_t id = typeIds[i];
+		if (id == EcsPrefab || (id & ECS_ROLE_MASK))
+		{
+			continue;
+		}
+
+		const EcsComponent* info = ecs_get(world, id, EcsComponent);
+		PrefabComponents.Add({ id, info ? (int32)info->size : 0 });
+	}
 }
 
@@ -13,6 +13,18 @@
 
 class ECS_World;
 
+//one component of a bulk spawn, with a value for every spawned entity laid out one after the other
+struct ECSSpawnColumn {
+	ecs_entity_t component;
+	int32 size;
+	const void* values;
+
+	template<typename T>
+	static ECSSpawnColumn From(ECS_Registry& registry, const TArray<T>& values) {
+		return { registry.component<T>().id(), (int32)sizeof(T), values.GetData() };
+	}
+};
+
 //base class for pure entity archetypes. This class cant be used directly, but can be spawned from an ECS spawner type system
 UCLASS(Blueprintable)
 class ECSTESTING_API AECS_Archetype : public AInfo
@@ -25,5 +37,27 @@ public:
 	
 
 	virtual EntityHandle CreateNewEntityFromThis(ECS_World* _ECS);
-	
+
+	//spawns count entities straight into their final table, with the default values of the archetype.
+	//A column replaces the defaults of its component, or adds the component if the archetype doesnt have it.
+	//The returned ids are only valid until the next entity is created
+	const EntityID* SpawnEntitiesFromThis(ECS_World* _ECS, int32 count, TArrayView<const ECSSpawnColumn> columns = {});
+
+private:
+
+	//builds a flecs prefab from the component wrappers. Done on the first spawn, the wrappers arent touched after that
+	void CompilePrefab(ECS_World* _ECS);
+
+	struct PrefabComponent {
+		ecs_entity_t id;
+		//0 for tags
+		int32 size;
+	};
+
+	ECS_World* PrefabWorld{ nullptr };
+	EntityID Prefab{ 0 };
+	//sorted by id, which is the order flecs keeps the columns of a table in
+	TArray<PrefabComponent> PrefabComponents;
+	//defaults repeated once per spawned entity, kept around between spawns
+	TArray<uint8, TAlignedHeapAllocator<16>> SpawnData;
 };
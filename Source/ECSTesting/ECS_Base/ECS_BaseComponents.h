@@ -90,6 +90,25 @@ struct FLastPosition {
 	FVector pos;
 };
 
+//transform at the start of the last simulation step, the renderers interpolate from it to the current one
+USTRUCT(BlueprintType)
+struct FPreviousTransform {
+
+	GENERATED_BODY()
+
+	FPreviousTransform() : pos(FVector::ZeroVector), rot(FQuat::Identity), bValid(false) {}
+
+	UPROPERTY(EditAnywhere, Category = ECS)
+	FVector pos;
+
+	UPROPERTY(EditAnywhere, Category = ECS)
+	FQuat rot;
+
+	//false until a simulation step has stored it
+	UPROPERTY(EditAnywhere, Category = ECS)
+	bool bValid;
+};
+
 USTRUCT(BlueprintType)
 struct FMovementRaycast {
 
@@ -111,8 +130,12 @@ struct FRaycastResult {
 	FTraceHandle handle;
 };
 
+//where the entity is in the spatial grid, written by the grid itself
 struct FGridMap {
-	FIntVector GridLocation;
+	FIntVector GridLocation{ FIntVector::ZeroValue };
+	//index of the cell and slot inside it, INDEX_NONE while the entity isnt in the grid
+	int32 Cell{ INDEX_NONE };
+	int32 Slot{ INDEX_NONE };
 };
 
 USTRUCT(BlueprintType)
@@ -175,8 +198,12 @@ USTRUCT(BlueprintType)
 struct FLifetime {
 	GENERATED_BODY()
 
+	//time the entity has left when the lifetime is set, it doesnt tick down
 	UPROPERTY(EditAnywhere, Category = "ECS")
 	float LifeLeft=0;
+
+	//simulation step the entity is destroyed on, worked out by the LifetimeSystem when the lifetime is set
+	uint64 ExpiryStep = 0;
 };
 
 //struct FDestroy
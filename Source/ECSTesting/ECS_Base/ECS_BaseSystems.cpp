@@ -2,10 +2,129 @@
 #include "ECS_BattleComponents.h"
 
 #include "SystemTasks.h"
+#include "Engine/LocalPlayer.h"
+#include "Engine/GameViewportClient.h"
+#include "GameFramework/PlayerController.h"
+#include "SceneView.h"
 
+namespace ECSCVars
+{
+	static int32 EnableCulling = 1;
+	FAutoConsoleVariableRef CVarECSEnableCulling(
+		TEXT("p.ECSEnableCulling"),
+		EnableCulling,
+		TEXT("Culls the instanced meshes against the view of the player before sending them to the ISMs\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static int32 FrustumCulling = 1;
+	FAutoConsoleVariableRef CVarECSFrustumCulling(
+		TEXT("p.ECSFrustumCulling"),
+		FrustumCulling,
+		TEXT("Culls the instanced meshes outside of the view frustum, needs p.ECSEnableCulling\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static int32 TrackTransformChanges = 1;
+	FAutoConsoleVariableRef CVarECSTrackTransformChanges(
+		TEXT("p.ECSTrackTransformChanges"),
+		TrackTransformChanges,
+		TEXT("Only packs the transforms of the tables that were written since the last frame, and only uploads the mesh instances that changed\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static float CullDistance = 0.f;
+	FAutoConsoleVariableRef CVarECSCullDistance(
+		TEXT("p.ECSCullDistance"),
+		CullDistance,
+		TEXT("Instanced meshes further than this from the view dont get drawn, needs p.ECSEnableCulling. 0 for no limit"),
+		ECVF_Default);
+}
+
+DECLARE_CYCLE_STAT(TEXT("ECS: Instance Mesh Cull View"), STAT_InstancedMeshCullView, STATGROUP_ECS);
 DECLARE_CYCLE_STAT(TEXT("ECS: Instance Mesh Prepare"), STAT_InstancedMeshPrepare, STATGROUP_ECS);
 DECLARE_CYCLE_STAT(TEXT("ECS: Instance Mesh Draw"), STAT_InstancedMeshDraw, STATGROUP_ECS);
 DECLARE_CYCLE_STAT(TEXT("ECS: Instance Mesh Clean"), STAT_InstancedMeshClean, STATGROUP_ECS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("ECS: Instances Submitted"), STAT_InstancesSubmitted, STATGROUP_ECS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("ECS: Instances Culled"), STAT_InstancesCulled, STATGROUP_ECS);
+DECLARE_DWORD_COUNTER_STAT(TEXT("ECS: Instances Uploaded"), STAT_InstancesUploaded, STATGROUP_ECS);
+
+//copies the transform columns of a table slice into the member transform of the items.
+//Tables that store a previous transform get blended from it to the current one, alpha being how far the frame is into the next step
+template<typename T>
+static void PackRenderTransforms(flecs::iter& it, T* items, FTransform T::* member, float alpha)
+{
+	const bool bInterpolate = it.has_column<FPreviousTransform>();
+
+	if (it.has_column<FPosition>())
+	{
+		auto pos = ECSTableColumn<const FPosition>(it);
+		if (bInterpolate)
+		{
+			auto prev = ECSTableColumn<const FPreviousTransform>(it);
+			for (auto i : it)
+			{
+				const FVector location = prev[i].bValid ? FMath::Lerp(prev[i].pos, pos[i].pos, alpha) : pos[i].pos;
+				(items[i].*member).SetLocation(location);
+			}
+		}
+		else
+		{
+			for (auto i : it)
+			{
+				(items[i].*member).SetLocation(pos[i].pos);
+			}
+		}
+	}
+
+	if (it.has_column<FRotationComponent>())
+	{
+		auto rot = ECSTableColumn<const FRotationComponent>(it);
+		if (bInterpolate)
+		{
+			auto prev = ECSTableColumn<const FPreviousTransform>(it);
+			for (auto i : it)
+			{
+				const FQuat rotation = prev[i].bValid ? FQuat::Slerp(prev[i].rot, rot[i].rot, alpha) : rot[i].rot;
+				(items[i].*member).SetRotation(rotation);
+			}
+		}
+		else
+		{
+			for (auto i : it)
+			{
+				(items[i].*member).SetRotation(rot[i].rot);
+			}
+		}
+	}
+	if (it.has_column<FScale>())
+	{
+		auto scale = ECSTableColumn<const FScale>(it);
+		for (auto i : it)
+		{
+			(items[i].*member).SetScale3D(scale[i].scale);
+		}
+	}
+}
+
+//records an add of T for the entities of the query that dont have it yet. The check is per table,
+//so once the tables have it the task costs nothing. T is registered here so a worker never has to register it
+template<typename T, typename... Q>
+static void AddMissingComponent(SystemTaskBuilder& builder, ECS_World* world, const flecs::query<Q...>& query)
+{
+	world->GetRegistry()->component<T>();
+	ECSCommandQueue* commands = &world->Commands;
+
+	builder.AddParallelForIter(query, TaskDependencies::FromQueries(query), [commands](flecs::iter it, auto*... columns) {
+		if (it.has_column<T>()) return;
+
+		ECSCommandBuffer& cmd = commands->GetThreadBuffer();
+		for (auto i : it)
+		{
+			cmd.Add<T>(it.entity(i).id());
+		}
+	});
+}
 
 StaticMeshDrawSystem::ISMData* StaticMeshDrawSystem::GetInstancedMeshForMesh(UStaticMesh* mesh)
 {
@@ -32,41 +151,134 @@ StaticMeshDrawSystem::ISMData* StaticMeshDrawSystem::GetInstancedMeshForMesh(USt
 
 		ISMData NewData;
 		NewData.ISM = NewComp;
-		NewData.rendered = 0;
+		NewData.Mesh = mesh;
+		NewData.MeshTag = ecs_new(World->GetRegistry()->c_ptr(), 0);
+		NewData.NumHidden = 0;
+		NewData.BoundsRadius = mesh ? mesh->GetBounds().SphereRadius : 0.f;
 		auto& d = MeshMap.Add(mesh, NewData);
 
 		return &d;
 	}
 }
 
+void StaticMeshDrawSystem::initialize(AActor* _Owner, ECS_World* _World)
+{
+	System::initialize(_Owner, _World);
+	ISM = nullptr;
+
+	//setting the mesh of an entity, by hand or through a spawn, gives it a slot
+	AddSetTrigger<FInstancedStaticMesh>([this](flecs::iter it, FInstancedStaticMesh* meshes) {
+		for (auto i : it)
+		{
+			AcquireSlot(it.entity(i).id(), meshes[i]);
+		}
+		//the set overwrote the RenderTransform, and new slots dont have a transform yet
+		World->TransformVersions.MarkTable(it.table_type().c_ptr());
+	});
+
+	//removing the mesh, or destroying the entity, frees the slot
+	AddRemoveTrigger<FInstancedStaticMesh>([this](flecs::iter it, FInstancedStaticMesh* meshes) {
+		for (auto i : it)
+		{
+			ISMData* MeshData = MeshMap.Find(meshes[i].mesh);
+			const int32 slot = meshes[i].instanceIndex;
+			if (MeshData && MeshData->SlotOwners.IsValidIndex(slot) && MeshData->SlotOwners[slot] == it.entity(i).id())
+			{
+				ReleaseSlot(*World->GetRegistry(), *MeshData, slot);
+			}
+			meshes[i].instanceIndex = -1;
+		}
+	});
+}
+
 void StaticMeshDrawSystem::update(ECS_Registry &registry, float dt)
 {
 }
 
-void  StaticMeshDrawSystem::schedule(ECSSystemScheduler* sysScheduler)
+void StaticMeshDrawSystem::AcquireSlot(EntityID Entity, FInstancedStaticMesh& Mesh)
 {
-	SystemTaskBuilder builder("StaticDraws", 1500, sysScheduler);
+	//a set can copy the slot of another entity, or keep the slot of the mesh the entity had before.
+	//The owner of the slot tells them apart
+	const int32 slot = Mesh.instanceIndex;
+	for (auto& i : MeshMap)
+	{
+		ISMData& OldData = i.Value;
+		if (OldData.SlotOwners.IsValidIndex(slot) && OldData.SlotOwners[slot] == Entity)
+		{
+			if (i.Key == Mesh.mesh)
+			{
+				return;
+			}
+			ReleaseSlot(*World->GetRegistry(), OldData, slot);
+			break;
+		}
+	}
 
-	float dt = 1.0 / 60.0;
+	ISMData* MeshData = GetInstancedMeshForMesh(Mesh.mesh);
+	if (!MeshData)
+	{
+		Mesh.instanceIndex = -1;
+		return;
+	}
 
+	Mesh.instanceIndex = MeshData->SlotOwners.Add(Entity);
+	MeshData->Transforms.AddUninitialized();
+	MeshData->SlotStates.Add(SlotDirty);
+}
+
+void StaticMeshDrawSystem::ReleaseSlot(ECS_Registry& registry, ISMData& MeshData, int32 Slot)
+{
+	const int32 last = MeshData.SlotOwners.Num() - 1;
+	if (MeshData.SlotStates[Slot] & SlotHidden)
+	{
+		MeshData.NumHidden--;
+	}
+	if (Slot != last)
+	{
+		//the entity of the last slot keeps its mesh, only its slot changes
+		const EntityID moved = MeshData.SlotOwners[last];
+		FInstancedStaticMesh* movedMesh = const_cast<FInstancedStaticMesh*>(flecs::entity(registry, moved).get<FInstancedStaticMesh>());
+		if (movedMesh)
+		{
+			movedMesh->instanceIndex = Slot;
+		}
+	}
+	MeshData.SlotOwners.RemoveAtSwap(Slot, 1, false);
+	MeshData.Transforms.RemoveAtSwap(Slot, 1, false);
+	MeshData.SlotStates.RemoveAtSwap(Slot, 1, false);
+	if (Slot != last)
+	{
+		MeshData.SlotStates[Slot] |= SlotDirty;
+	}
+}
+
+void  StaticMeshDrawSystem::schedule(ECSSystemScheduler* sysScheduler)
+{
+	SystemTaskBuilder builder("StaticDraws", 1500, sysScheduler);
+	builder.SetPhase(ESystemPhase::Frame);
 
 	init_query(q_transform, sysScheduler->registry);
 
+	//the view is only read by the pack, after this
+	builder.AddGameTask(TaskDependencies{}, [this](ECS_Registry& reg) {
+			SCOPE_CYCLE_COUNTER(STAT_InstancedMeshCullView);
+			CaptureView();
+		}, ESysTaskFlags::NoECS);
+
 	{
 
-	TaskDependencies deps;
-	deps.AddWrite<FInstancedStaticMesh>();
+	//pack_transforms reads the transform columns of the mesh tables directly, those arent in the query signature
+	TaskDependencies deps = TaskDependencies::FromQueries(q_transform);
 	deps.AddRead<FPosition>();
 	deps.AddRead<FRotationComponent>();
 	deps.AddRead<FScale>();
+	deps.AddRead<FPreviousTransform>();
 
-	builder.AddDependency("Movement");
-
-	builder.AddTask(TaskDependencies{}, [=](ECS_Registry& reg) {
+	//copy transforms into the ISM RenderTransform, and the visible ones into the slot of every entity.
+	//The slots are unique, so the chunks can write them at the same time
+	builder.AddParallelForIter(q_transform, deps, [this](flecs::iter it, FInstancedStaticMesh* t) {
 			SCOPE_CYCLE_COUNTER(STAT_InstancedMeshPrepare);
-			//copy transforms into the ISM RenderTransform
-
-			pack_transforms();
+			WriteInstances(it, t);
 		});
 
 	}
@@ -78,106 +290,233 @@ void  StaticMeshDrawSystem::schedule(ECSSystemScheduler* sysScheduler)
 		//builder.AddGameTask(deps,
 		builder.AddTask(deps,
 			[=](ECS_Registry& reg) {
-				this->Elapsed -= dt;
-				if (this->Elapsed < 0)
+				SCOPE_CYCLE_COUNTER(STAT_InstancedMeshDraw);
+				NumSubmitted = 0;
+				NumCulled = 0;
+				for (auto& i : MeshMap)
 				{
-					this->Elapsed = 1;
-					for (auto i : MeshMap)
+					if (IsValid(i.Value.ISM))
 					{
-						i.Value.ISM->ClearInstances();
+						UploadInstances(i.Value);
 					}
+					NumSubmitted += i.Value.SlotOwners.Num() - i.Value.NumHidden;
+					NumCulled += i.Value.NumHidden;
 				}
+				INC_DWORD_STAT_BY(STAT_InstancesSubmitted, NumSubmitted);
+				INC_DWORD_STAT_BY(STAT_InstancesCulled, NumCulled);
 
-				for (auto &i : MeshMap)
-				{
-					i.Value.rendered = 0;
-				}
+				//the next draw packs whatever gets written from this step on
+				PackedStep = ECSCVars::TrackTransformChanges ? World->Clock.StepCount : 0;
+			}
+		);
+	}
 
-				{
-					SCOPE_CYCLE_COUNTER(STAT_InstancedMeshDraw);
-					q_transform.each([&](auto et, FInstancedStaticMesh& mesh) {
+	sysScheduler->AddTaskgraph(builder.FinishGraph());
+}
+
+void StaticMeshDrawSystem::pack_transforms(flecs::iter& it, FInstancedStaticMesh* t)
+{
+	PackRenderTransforms(it, t, &FInstancedStaticMesh::RenderTransform, World->Clock.InterpolationAlpha);
+}
+
+void StaticMeshDrawSystem::CaptureView()
+{
+	const CullView LastView = View;
+	View.bValid = false;
+
+	UWorld* GameWorld = OwnerActor->GetWorld();
+	APlayerController* PC = GameWorld ? GameWorld->GetFirstPlayerController() : nullptr;
+	ULocalPlayer* Player = PC ? PC->GetLocalPlayer() : nullptr;
+	FSceneViewProjectionData Projection;
+	if (ECSCVars::EnableCulling && Player && Player->ViewportClient && Player->ViewportClient->Viewport
+		&& Player->GetProjectionData(Player->ViewportClient->Viewport, eSSP_FULL, Projection))
+	{
+		View.ViewProjection = Projection.ComputeViewProjectionMatrix();
+		GetViewFrustumBounds(View.Frustum, View.ViewProjection, false);
+		View.Origin = Projection.ViewOrigin;
+		View.MaxDistance = FMath::Max(ECSCVars::CullDistance, 0.f);
+		View.bFrustum = ECSCVars::FrustumCulling != 0;
+		View.bValid = true;
+	}
+
+	//the frustum comes from the matrix, so the matrix and the settings are enough to compare
+	if (View.bValid && LastView.bValid)
+	{
+		bViewChanged = !View.ViewProjection.Equals(LastView.ViewProjection, 0.f) || View.Origin != LastView.Origin
+			|| View.MaxDistance != LastView.MaxDistance || View.bFrustum != LastView.bFrustum;
+	}
+	else
+	{
+		bViewChanged = View.bValid || LastView.bValid;
+	}
 
+	if (!ECSCVars::TrackTransformChanges)
+	{
+		bViewChanged = true;
+	}
+}
 
-						auto MeshData = GetInstancedMeshForMesh(mesh.mesh);
-						auto RenderMesh = MeshData->ISM;
+void StaticMeshDrawSystem::WriteInstances(flecs::iter& it, FInstancedStaticMesh* t)
+{
+	static const FTransform HiddenTransform(FQuat::Identity, FVector::ZeroVector, FVector::ZeroVector);
 
-						const FTransform& RenderTransform = mesh.RenderTransform;
+	//spawns, mesh changes and new slots all mark the table, so the rows of a table that didnt change are already in their slots
+	const bool bTableChanged = World->TransformVersions.ChangedSince(it.table_type().c_ptr(), PackedStep);
+	if (!bTableChanged && !bViewChanged) return;
 
-						if (RenderMesh->GetInstanceCount() < MeshData->rendered)
-						{
-							RenderMesh->AddInstanceWorldSpace(RenderTransform);
-						}
-						else
-						{
-							RenderMesh->UpdateInstanceTransform(MeshData->rendered, RenderTransform, true, false);
-						}
-						MeshData->rendered++;
-					});
+	if (bTableChanged)
+	{
+		pack_transforms(it, t);
+	}
+
+	//the tag of the table gives the mesh of every row. Nothing adds meshes to the map while the pack runs
+	ISMData* TableMesh = FindTableMesh(it.table_type().c_ptr());
+	TArray<EntityID> untagged;
+
+	for (auto i : it)
+	{
+		ISMData* MeshData = TableMesh;
+		if (!TableMesh || t[i].mesh != TableMesh->Mesh)
+		{
+			//spawned since the last frame, or its mesh changed. It gets moved to the table of its mesh
+			MeshData = MeshMap.Find(t[i].mesh);
+			untagged.Add(it.entity(i).id());
+		}
+		if (!MeshData || !MeshData->Transforms.IsValidIndex(t[i].instanceIndex)) continue;
+
+		const int32 slot = t[i].instanceIndex;
+		uint8& state = MeshData->SlotStates[slot];
+		const bool bWasHidden = (state & SlotHidden) != 0;
+		const bool bVisible = IsVisible(t[i].RenderTransform, MeshData->BoundsRadius);
+
+		if (bVisible && (bTableChanged || bWasHidden))
+		{
+			MeshData->Transforms[slot] = t[i].RenderTransform;
+			state = SlotDirty;
+		}
+		else if (!bVisible && !bWasHidden)
+		{
+			MeshData->Transforms[slot] = HiddenTransform;
+			state = SlotDirty | SlotHidden;
+		}
+
+		//a mesh can be in several tables, the slices of different tables can change its count at once
+		if (bWasHidden != !bVisible)
+		{
+			FPlatformAtomics::InterlockedAdd(&MeshData->NumHidden, bVisible ? -1 : 1);
+		}
+	}
+
+	if (untagged.Num() > 0)
+	{
+		World->Commands.GetThreadBuffer().Call([this, entities = MoveTemp(untagged)](flecs::world& reg) {
+			RetagEntities(reg, entities);
+		});
+	}
+}
+
+StaticMeshDrawSystem::ISMData* StaticMeshDrawSystem::FindTableMesh(ecs_type_t type)
+{
+	//there are only a few meshes, checking each tag is cheaper than hashing
+	ecs_world_t* world = World->GetRegistry()->c_ptr();
+	for (auto& i : MeshMap)
+	{
+		if (ecs_type_has_entity(world, type, i.Value.MeshTag))
+		{
+			return &i.Value;
+		}
+	}
+	return nullptr;
+}
+
+void StaticMeshDrawSystem::RetagEntities(ECS_Registry& registry, const TArray<EntityID>& Entities)
+{
+	ecs_world_t* world = registry.c_ptr();
+	for (EntityID entity : Entities)
+	{
+		//the mesh can have changed again since the entity was found
+		if (!ecs_is_alive(world, entity)) continue;
+		const FInstancedStaticMesh* mesh = flecs::entity(registry, entity).get<FInstancedStaticMesh>();
+		if (!mesh) continue;
+
+		for (auto& i : MeshMap)
+		{
+			const bool bWanted = i.Key == mesh->mesh;
+			if (bWanted != ecs_has_entity(world, entity, i.Value.MeshTag))
+			{
+				if (bWanted)
+				{
+					ecs_add_entity(world, entity, i.Value.MeshTag);
 				}
+				else
 				{
-					SCOPE_CYCLE_COUNTER(STAT_InstancedMeshClean)
-						for (auto& i : MeshMap)
-						{
-							FTransform nulltransform;
-							nulltransform.SetScale3D(FVector(0.0, 0.0, 0.0));
-
-							//if we have more instances than renderables, set the instances to null transform so they dont draw.
-							//they will get cleanup once a second.
-							if (IsValid(i.Value.ISM))
-							{
-								while (i.Value.rendered < i.Value.ISM->GetInstanceCount())
-								{
-
-									i.Value.rendered++;
-									i.Value.ISM->UpdateInstanceTransform(i.Value.rendered, nulltransform, true, false);
-
-								}
-								i.Value.ISM->MarkRenderStateDirty();
-							}
-						}
+					ecs_remove_entity(world, entity, i.Value.MeshTag);
 				}
 			}
-		);
+		}
 	}
-
-	sysScheduler->AddTaskgraph(builder.FinishGraph());
 }
 
-void StaticMeshDrawSystem::pack_transforms()
+void StaticMeshDrawSystem::UploadInstances(ISMData& MeshData)
 {
-	q_transform.iter([&](flecs::iter it, FInstancedStaticMesh* t) {
+	UInstancedStaticMeshComponent* RenderMesh = MeshData.ISM;
+	const int32 numSlots = MeshData.SlotOwners.Num();
 
-		if (it.has_column<FPosition>())
+	//the instances follow the slots, removing from the end never moves the other instances
+	{
+		SCOPE_CYCLE_COUNTER(STAT_InstancedMeshClean);
+		for (int32 i = RenderMesh->GetInstanceCount() - 1; i >= numSlots; i--)
 		{
-			auto pos = it.table_column<const FPosition>();
-			for (auto i : it)
-			{
-				t[i].RenderTransform.SetLocation(pos[i].pos);
-			}
+			RenderMesh->RemoveInstance(i);
 		}
+	}
 
-		if (it.has_column<FRotationComponent>())
+	//missing instances only need to exist, the batch sets their transform
+	for (int32 i = RenderMesh->GetInstanceCount(); i < numSlots; i++)
+	{
+		RenderMesh->AddInstance(FTransform::Identity);
+	}
+
+	//the ISM sits at the origin with no rotation or scale, so the transforms are already in its space.
+	//Runs of dirty slots go in one batch, short gaps of clean slots included, they are cheaper to send again than to split the batch
+	int32 numUploaded = 0;
+	int32 slot = 0;
+	while (slot < numSlots)
+	{
+		if (!(MeshData.SlotStates[slot] & SlotDirty))
 		{
-			auto pos = it.table_column<const FRotationComponent>();
-			for (auto i : it)
-			{
-				t[i].RenderTransform.SetRotation(pos[i].rot);
-			}
+			slot++;
+			continue;
 		}
-		if (it.has_column<FScale>())
+
+		const int32 first = slot;
+		int32 last = slot;
+		for (; slot < numSlots && slot - last <= MaxUploadGap; slot++)
 		{
-			auto pos = it.table_column<const FScale>();
-			for (auto i : it)
+			if (MeshData.SlotStates[slot] & SlotDirty)
 			{
-				t[i].RenderTransform.SetScale3D(pos[i].scale);
+				MeshData.SlotStates[slot] &= ~SlotDirty;
+				last = slot;
 			}
 		}
-		});
+
+		UploadBatch.Reset();
+		UploadBatch.Append(&MeshData.Transforms[first], last - first + 1);
+		RenderMesh->BatchUpdateInstancesTransforms(first, UploadBatch, false, false, false);
+		numUploaded += UploadBatch.Num();
+		slot = last + 1;
+	}
+
+	if (numUploaded > 0)
+	{
+		RenderMesh->MarkRenderStateDirty();
+	}
+	INC_DWORD_STAT_BY(STAT_InstancesUploaded, numUploaded);
 }
 
-EntityHandle ArchetypeSpawnerSystem::SpawnFromArchetype(ECS_Registry& registry, TSubclassOf<AECS_Archetype>& ArchetypeClass)
+AECS_Archetype* ArchetypeSpawnerSystem::FindArchetype(TSubclassOf<AECS_Archetype>& ArchetypeClass)
 {
-	//try to find the spawn archetype in the map, spawn a new one if not found, use it to initialize entity
+	//try to find the spawn archetype in the map, spawn a new one if not found
 
 	auto Found = Archetypes.Find(ArchetypeClass);
 	AECS_Archetype* FoundArchetype = nullptr;
@@ -198,16 +537,36 @@ EntityHandle ArchetypeSpawnerSystem::SpawnFromArchetype(ECS_Registry& registry,
 	{
 		FoundArchetype = *Found;
 	}
-	if (FoundArchetype)
-	{
-		return FoundArchetype->CreateNewEntityFromThis(World);
-	}
-	else
+	return FoundArchetype;
+}
+
+void ArchetypeSpawnerSystem::SpawnBatches(ECS_Registry& registry, TArray<SpawnBatch>& Batches)
+{
+	SCOPE_CYCLE_COUNTER(STAT_ECSSpawn);
+
+	for (SpawnBatch& batch : Batches)
 	{
-		UE_LOG(LogFlying, Warning, TEXT("Failed new Entity: %s"), *GetNameSafe(ArchetypeClass));
-	}
+		AECS_Archetype* Archetype = FindArchetype(batch.ArchetypeClass);
+		if (!Archetype)
+		{
+			UE_LOG(LogFlying, Warning, TEXT("Failed new Entity: %s"), *GetNameSafe(batch.ArchetypeClass));
+			continue;
+		}
 
-	return EntityHandle();
+		TArray<ECSSpawnColumn, TInlineAllocator<3>> columns;
+		columns.Add(ECSSpawnColumn::From(registry, batch.Positions));
+		if (batch.bHasVelocity)
+		{
+			columns.Add(ECSSpawnColumn::From(registry, batch.Velocities));
+		}
+		if (batch.bHasFaction)
+		{
+			columns.Add(ECSSpawnColumn::From(registry, batch.Factions));
+		}
+
+		//the whole batch goes into the final table in one go
+		Archetype->SpawnEntitiesFromThis(World, batch.Positions.Num(), columns);
+	}
 }
 
 void ArchetypeSpawnerSystem::update(ECS_Registry &registry, float dt)
@@ -218,21 +577,18 @@ void ArchetypeSpawnerSystem::update(ECS_Registry &registry, float dt)
 void ArchetypeSpawnerSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("Spawner", 1000000, sysScheduler,0.1);
-	float dt = 1.0 / 60.0;
 	
 
 	init_query(q_arcspawners, sysScheduler->registry);
 	init_query(q_spawners, sysScheduler->registry);
 
-	TaskDependencies deps;
-
-	deps.AddWrite<FArchetypeSpawner>();
 	builder.AddDependency("EndBarrier");
-	builder.AddTask(TaskDependencies{}, 
+	builder.AddTask(q_spawners,
 	//builder.AddSyncTask(
 		[=](ECS_Registry& reg) {
 
 		SCOPE_CYCLE_COUNTER(STAT_ECSSpawn);
+		const float dt = World->Clock.StepDeltaTime;
 
 		//exclusively update timing
 		q_spawners.each([dt](auto e, FArchetypeSpawner& spawner) {
@@ -241,37 +597,59 @@ void ArchetypeSpawnerSystem::schedule(ECSSystemScheduler* sysScheduler)
 	});
 	
 
-	builder.AddSyncTask(
+	//the spawns need the archetype actors, so they are recorded as a call that runs on the game thread when the commands are applied.
+	//Spawns of the same archetype are batched and created together
+	TaskDependencies spawnDeps = TaskDependencies::FromQueries(q_arcspawners, q_spawners);
+	spawnDeps.AddRead<FFaction>();
+	spawnDeps.AddRead<FPosition>();
+
+	builder.AddTask(spawnDeps,
 		[=](ECS_Registry& reg) {
-			//return;
 			SCOPE_CYCLE_COUNTER(STAT_ECSSpawn);
-		//spawn from arc and actortransform
-			reg.defer_begin();
-			
+			ECSCommandBuffer& cmd = World->Commands.GetThreadBuffer();
+
+			TArray<SpawnBatch> Batches;
+			auto FindBatch = [&](const TSubclassOf<AECS_Archetype>& ArchetypeClass, bool bHasVelocity, bool bHasFaction) -> SpawnBatch& {
+				for (SpawnBatch& batch : Batches)
+				{
+					if (batch.ArchetypeClass == ArchetypeClass && batch.bHasVelocity == bHasVelocity && batch.bHasFaction == bHasFaction)
+					{
+						return batch;
+					}
+				}
+				SpawnBatch& batch = Batches.AddDefaulted_GetRef();
+				batch.ArchetypeClass = ArchetypeClass;
+				batch.bHasVelocity = bHasVelocity;
+				batch.bHasFaction = bHasFaction;
+				return batch;
+			};
+
+			//spawn from arc and actortransform
 			q_arcspawners.each([&](auto e, FArchetypeSpawner& spawner, FRandomArcSpawn& arc, FActorTransform& ActorTransform) {
 				
 				if (spawner.TimeUntilSpawn < 0)
 				{
 					if (spawner.ArchetypeClass)
 					{
-						EntityHandle h = SpawnFromArchetype(reg, spawner.ArchetypeClass);
-						flecs::entity spawned{ reg,h.handle };
-						spawned.set<FPosition>({ ActorTransform.transform.GetLocation() });
+						const FVector SpawnPosition = ActorTransform.transform.GetLocation();
+						const bool bHasFaction = e.has<FFaction>();
+						const FFaction Faction = bHasFaction ? *e.get<FFaction>() : FFaction();
 
-						if (e.has<FFaction>())
-						{
-							spawned.set<FFaction>(*e.get<FFaction>());
-						}
-
-						FVelocity vel;
 						const float VelMagnitude = World->rng.FRandRange(arc.MinVelocity, arc.MaxVelocity);
 						const float Arc = FMath::DegreesToRadians(World->rng.FRandRange(arc.MinAngle, arc.MaxAngle));
 
 
 						FVector ArcVel = World->rng.VRandCone(FVector(1.0, 0.0, 0.0), Arc) * VelMagnitude;
 
-						FVector BulletVelocity = ActorTransform.transform.GetRotation().RotateVector(ArcVel);
-						spawned.set<FVelocity>(BulletVelocity);
+						const FVector BulletVelocity = ActorTransform.transform.GetRotation().RotateVector(ArcVel);
+
+						SpawnBatch& batch = FindBatch(spawner.ArchetypeClass, true, bHasFaction);
+						batch.Positions.Add(FPosition{ SpawnPosition });
+						batch.Velocities.Add(FVelocity{ BulletVelocity });
+						if (bHasFaction)
+						{
+							batch.Factions.Add(Faction);
+						}
 					}
 
 					if (spawner.bLoopSpawn)
@@ -280,7 +658,7 @@ void ArchetypeSpawnerSystem::schedule(ECSSystemScheduler* sysScheduler)
 					}
 					else
 					{
-						e.remove<FArchetypeSpawner>();
+						cmd.Remove<FArchetypeSpawner>(e.id());
 					}
 				}
 			});
@@ -288,14 +666,12 @@ void ArchetypeSpawnerSystem::schedule(ECSSystemScheduler* sysScheduler)
 			//Spawn with basic position
 			q_spawners.each([&](auto e, FArchetypeSpawner& spawner) {
 				if (!e.has<FPosition>()) return;
-				const FVector& SpawnPosition = e.get<FPosition>()->pos;
+				const FVector SpawnPosition = e.get<FPosition>()->pos;
 				if (spawner.TimeUntilSpawn < 0)
 				{
 					if (IsValid(spawner.ArchetypeClass))
 					{
-						EntityHandle h = SpawnFromArchetype(reg, spawner.ArchetypeClass);
-						flecs::entity spawned{ reg,h.handle };
-						spawned.set<FPosition>(FPosition{ SpawnPosition });
+						FindBatch(spawner.ArchetypeClass, false, false).Positions.Add(FPosition{ SpawnPosition });
 					}
 
 					if (spawner.bLoopSpawn)
@@ -304,12 +680,17 @@ void ArchetypeSpawnerSystem::schedule(ECSSystemScheduler* sysScheduler)
 					}
 					else
 					{
-						e.remove<FArchetypeSpawner>();
+						cmd.Remove<FArchetypeSpawner>(e.id());
 					}
 				}
 			});
-		
-			reg.defer_end();
+
+			if (Batches.Num() > 0)
+			{
+				cmd.Call([this, Batches = MoveTemp(Batches)](ECS_Registry& reg) mutable {
+					SpawnBatches(reg, Batches);
+				});
+			}
 		}
 	);
 
@@ -323,7 +704,7 @@ void RaycastSystem::update(ECS_Registry &registry, float dt)
 
 void RaycastSystem::CheckRaycasts(ECS_Registry& registry, float dt, UWorld* GameWorld)
 {
-	rayUnits.Reset();
+	ECSFrameArray<RaycastUnit> rayUnits(World->ScratchPad, rayRequests.Num());
 
 	//check all the raycast results from the async raycast	
 	for (auto& ray : rayRequests)
@@ -366,19 +747,16 @@ void RaycastSystem::CheckRaycasts(ECS_Registry& registry, float dt, UWorld* Game
 	});
 }
 
-void RaycastSystem::CreateExplosion(ECS_Registry& registry, EntityID entity, FVector ExplosionPoint)
+void RaycastSystem::CreateExplosion(ECSCommandBuffer& cmd, const FProjectile& projectile, FVector ExplosionPoint)
 {
-	flecs::entity e{ registry,entity };
-
-	auto explosionclass = e.get<const FProjectile>()->ExplosionArchetypeClass;
+	auto explosionclass = projectile.ExplosionArchetypeClass;
 	if (explosionclass)
 	{
 		//create new entity to spawn explosion
-		auto h = ecs_new(registry.c_ptr(), 0);
-		flecs::entity spawner{ registry,h };
+		ECSDeferredEntity spawner = cmd.Create();
 		
-		spawner.set<FPosition>({ ExplosionPoint });
-		spawner.set<FLifetime>({ 0.1 });
+		cmd.Set<FPosition>(spawner, { ExplosionPoint });
+		cmd.Set<FLifetime>(spawner, { 0.1 });
 
 		FArchetypeSpawner spawn;
 		spawn.bLoopSpawn = false;
@@ -386,7 +764,7 @@ void RaycastSystem::CreateExplosion(ECS_Registry& registry, EntityID entity, FVe
 		spawn.SpawnRate = 1;
 		spawn.TimeUntilSpawn = 0.0;
 		spawn.Canary = 69;
-		spawner.set<FArchetypeSpawner>({ spawn });
+		cmd.Set<FArchetypeSpawner>(spawner, spawn);
 	}
 }
 
@@ -395,40 +773,42 @@ DECLARE_CYCLE_STAT(TEXT("ECS: Raycast Explosions"), STAT_RaycastExplosions, STAT
 DECLARE_CYCLE_STAT(TEXT("ECS: Raycast Enqueue"), STAT_RaycastResults, STATGROUP_ECS);
 void  RaycastSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
+	//traces are issued and read back once per frame, between the positions from before and after all the substeps
 	SystemTaskBuilder builder("RayCheck", 999, sysScheduler);
+	builder.SetPhase(ESystemPhase::Frame);
 
 	init_query(q_rays, sysScheduler->registry);
 	init_query(q_raycreate, sysScheduler->registry);
 
 	TaskDependencies deps1;
-	float dt = 1.0 / 60.0;
-	deps1.AddRead<FRaycastResult>();
+	deps1.AddRead<FProjectile>();
 
 	//builder.AddGameTask(deps,
 	builder.AddTask(deps1, [=](ECS_Registry& reg) {
 
 		SCOPE_CYCLE_COUNTER(STAT_ECSRaycast);
 		UWorld* GameWorld = OwnerActor->GetWorld();
-		this->CheckRaycasts(reg, dt,GameWorld);
+		this->CheckRaycasts(reg, World->Clock.FrameDeltaTime,GameWorld);
 	});
 
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
 
-	TaskDependencies deps2;
-	//deps2.AddWrite< FRaycastResult >();
-	deps2.AddRead<FMovementRaycast>();
-	deps2.AddRead<FPosition>();
-	deps2.AddRead<FLastPosition>();
-	//deps2.AddWrite<ECS_Registry>();
-
 	SystemTaskBuilder builder_ray("Raycast", 999, sysScheduler,2.5);
+	builder_ray.SetPhase(ESystemPhase::Frame);
 
-	builder_ray.AddTask(deps2, [=](ECS_Registry& reg) {
+	builder_ray.AddTask(q_raycreate, [=](ECS_Registry& reg) {
 		SCOPE_CYCLE_COUNTER(STAT_RaycastResults);
 
 		//add raycast result in bulk to whatever doesnt have one yet		
 		rayRequests.Reset();
-		q_raycreate.each([&, dt](auto entity, const FMovementRaycast& ray, const FPosition& pos, const FLastPosition& lastPos/*, FRaycastResult& handle*/) {
+
+		//nothing moved this frame, so there are no new rays to cast
+		if (World->Clock.NumSubsteps == 0)
+		{
+			return;
+		}
+
+		q_raycreate.each([&](auto entity, const FMovementRaycast& ray, const FPosition& pos, const FLastPosition& lastPos/*, FRaycastResult& handle*/) {
 
 			if (pos.pos != lastPos.pos)
 			{
@@ -441,10 +821,10 @@ void  RaycastSystem::schedule(ECSSystemScheduler* sysScheduler)
 			}
 			});
 		});
-	builder_ray.AddDependency("Movement");
 	builder_ray.AddDependency("RayCheck");
 
 	SystemTaskBuilder builder_rayg("RaycastGame", 1200, sysScheduler, 5);
+	builder_rayg.SetPhase(ESystemPhase::Frame);
 	builder_rayg.AddGameTask({},[=](ECS_Registry& reg) {
 		SCOPE_CYCLE_COUNTER(STAT_RaycastResults);
 		UWorld* GameWorld = OwnerActor->GetWorld();
@@ -460,27 +840,30 @@ void  RaycastSystem::schedule(ECSSystemScheduler* sysScheduler)
 	sysScheduler->AddTaskgraph(builder_ray.FinishGraph());
 		
 	SystemTaskBuilder builder2("RayExplosions", LifetimeSystem::DeletionSync-1, sysScheduler);
-	builder2.AddSyncTask(
+	builder2.SetPhase(ESystemPhase::Frame);
+	TaskDependencies deps2;
+	deps2.AddRead<FProjectile>();
+
+	builder2.AddTask(deps2,
 		[=](ECS_Registry& reg) {
 
 			SCOPE_CYCLE_COUNTER(STAT_RaycastExplosions);
 
-			DeletionContext* del = DeletionContext::GetFromRegistry(reg);
-			reg.defer_begin();
-			bulk_dequeue(explosions, [&reg,&del,this](const ExplosionStr& ex) {
+			ECSCommandBuffer& cmd = World->Commands.GetThreadBuffer();
+			bulk_dequeue(explosions, [&](const ExplosionStr& ex) {
 				flecs::entity e{ reg,ex.et };
-				if (e.has<FProjectile>())
+				if (const FProjectile* projectile = e.get<FProjectile>())
 				{
-					CreateExplosion(reg, ex.et, ex.explosionPoint);
+					CreateExplosion(cmd, *projectile, ex.explosionPoint);
 				}
-				del->AddToQueue(ex.et);
+				cmd.Destroy(ex.et);
 			});		
-			reg.defer_end();
 		}
 	);
-	builder2.AddDependency("EndBarrier");
+	builder2.AddDependency("RayCheck");
 
 	SystemTaskBuilder builder3("raycast system: broadcast BP", 0, sysScheduler);
+	builder3.SetPhase(ESystemPhase::Frame);
 	builder3.AddDependency("Raycast");
 	builder3.AddGameTask(TaskDependencies {},
 		[=](ECS_Registry& reg) {
@@ -502,21 +885,41 @@ void  RaycastSystem::schedule(ECSSystemScheduler* sysScheduler)
 			
 		}, ESysTaskFlags::NoECS
 	);
-	builder3.AddDependency("EndBarrier");
+	builder3.AddDependency("RayCheck");
 	sysScheduler->AddTaskgraph(builder2.FinishGraph());
 
 	sysScheduler->AddTaskgraph(builder3.FinishGraph());
 }
 
+void LifetimeSystem::initialize(AActor* _Owner, ECS_World* _World)
+{
+	System::initialize(_Owner, _World);
+	Expiries.Reset(World->Clock.StepCount + 1);
+
+	//setting a lifetime, by hand or through a spawn, puts the entity on the wheel.
+	//Setting it again puts it there a second time, the old timer gets skipped because the expiry step changed
+	AddSetTrigger<FLifetime>([this](flecs::iter it, FLifetime* lifetimes) {
+		for (auto i : it)
+		{
+			ScheduleExpiry(it.entity(i).id(), lifetimes[i]);
+		}
+	});
+}
+
 void LifetimeSystem::update(ECS_Registry& registry, float dt)
 {
 	
 }
 
+void LifetimeSystem::ScheduleExpiry(EntityID Entity, FLifetime& Lifetime)
+{
+	Lifetime.ExpiryStep = World->Clock.StepAfter(Lifetime.LifeLeft);
+	Expiries.Schedule(Entity, Lifetime.ExpiryStep);
+}
+
 
 
 DECLARE_CYCLE_STAT(TEXT("ECS: Lifetime count"), STAT_LifeCount, STATGROUP_ECS);
-DECLARE_CYCLE_STAT(TEXT("ECS: Lifetime Delete"), STAT_LifeDelete, STATGROUP_ECS);
 
 void  LifetimeSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
@@ -535,135 +938,100 @@ void  LifetimeSystem::schedule(ECSSystemScheduler* sysScheduler)
 
 	SystemTaskBuilder builder("lifetime system", 100000, sysScheduler);
 
-	DeletionContext::GetFromRegistry(*sysScheduler->registry);
-
-	TaskDependencies deps;
-	deps.AddWrite<FLifetime>();
+	ECSCommandQueue* commands = &World->Commands;
+	const ECSWorldClock* clock = &World->Clock;
 
 	builder.AddDependency("EndBarrier");
-	builder.AddTask(
-		deps,
-		[=](ECS_Registry& reg) {
-			SCOPE_CYCLE_COUNTER(STAT_LifeCount);
-			DeletionContext* del = DeletionContext::GetFromRegistry(reg);
-
-			//tick the lifetime timers
-			
-			q_lifetime.each([&](auto e, FLifetime& Deleter) {
-
-				Deleter.LifeLeft -= 1.0 / 60.0;
 
-				if (Deleter.LifeLeft < 0)
+	//pop the entities that expire on this step, they are destroyed when the commands are applied
+	TaskDependencies deps;
+	deps.AddRead<FLifetime>();
+	builder.AddTask(deps,
+		[this, commands, clock](ECS_Registry& reg) {
+			SCOPE_CYCLE_COUNTER(STAT_Lifetime);
+			ECSCommandBuffer& cmd = commands->GetThreadBuffer();
+
+			Expiries.Advance(clock->StepCount, [&](const ECSTimerWheel::Timer& timer) {
+				//the entity can be gone already, or have a newer lifetime
+				flecs::entity e(reg, timer.Entity);
+				if (!e.is_alive()) return;
+
+				const FLifetime* lifetime = e.get<FLifetime>();
+				if (lifetime && lifetime->ExpiryStep == timer.Step)
 				{
-					del->AddToQueue(e.id());
+					cmd.Destroy(timer.Entity);
 				}
 			});
 		});
 
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
-
-	//SystemTaskBuilder builder2("lifetime system- Delete", LifetimeSystem::DeletionSync, sysScheduler);
-	SystemTaskBuilder builder2("lifetime system- Delete", 0, sysScheduler, 0.1);
-	builder2.AddDependency("lifetime system");
-	builder2.AddSyncTask(
-		[=](ECS_Registry& reg) {			
-
-			SCOPE_CYCLE_COUNTER(STAT_LifeDelete);
-			DeletionContext* del = DeletionContext::GetFromRegistry(reg);
-
-			bulk_dequeue(del->entitiesToDelete, [&](EntityID id) {
-				flecs::entity et{ reg,id };
-				if (et.is_alive())
-				{
-					et.destruct();
-				}
-			});
-		}
-	);
-
-	sysScheduler->AddTaskgraph(builder2.FinishGraph());
 }
 
 void CopyTransformToActorSystem::update(ECS_Registry& registry, float dt)
 {
 }
 
-void CopyTransformToActorSystem::PackTransforms(ECS_Registry& registry)
+void CopyTransformToActorSystem::PackTransforms(flecs::iter& it, FActorTransform* t)
+{
+	if (!World->TransformVersions.ChangedSince(it.table_type().c_ptr(), PackedStep)) return;
+
+	PackRenderTransforms(it, t, &FActorTransform::transform, World->Clock.InterpolationAlpha);
+}
+
+void CopyTransformToActorSystem::GatherActorTransforms(ECS_Registry& registry)
 {
 	SCOPE_CYCLE_COUNTER(STAT_PackActorTransform);
-	{
-		q_transform.iter([&](flecs::iter it, FActorTransform* t) {
 
-			if (it.has_column<FPosition>())
-			{
-				auto pos = it.table_column<const FPosition>();
-				for (auto i : it)
-				{
-					t[i].transform.SetLocation(pos[i].pos);
-				}
-			}
+	transforms.Reset(World->ScratchPad);
+	q_actors.iter([&](flecs::iter it, const FActorTransform* t, const FActorReference* actor, const FCopyTransformToActor* copy) {
+		//the actors of the tables that didnt change are already where they should be
+		if (!World->TransformVersions.ChangedSince(it.table_type().c_ptr(), PackedStep)) return;
 
-			if (it.has_column<FRotationComponent>())
-			{
-				auto pos = it.table_column<const FRotationComponent>();
-				for (auto i : it)
-				{
-					t[i].transform.SetRotation(pos[i].rot);
-				}
-			}
-			if (it.has_column<FScale>())
-			{
-				auto pos = it.table_column<const FScale>();
-				for (auto i : it)
-				{
-					t[i].transform.SetScale3D(pos[i].scale);
-				}
-			}
-			if (it.has_column<FCopyTransformToActor>())
+		for (auto i : it)
+		{
+			if (actor[i].ptr.IsValid())
 			{
-				if (it.has_column<FActorReference>())
-				{
-					auto actors = it.table_column<FActorReference>();
-					for (auto i : it)
-					{
-						if (actors[i].ptr.IsValid())
-						{
-							transforms.Add({ actors[i].ptr,t[i].transform });
-						}
-					}
-				}
+				transforms.Add({ actor[i].ptr, t[i].transform });
 			}
-		});
-	}
+		}
+	});
 
+	//the next pack picks up whatever gets written from this step on
+	PackedStep = ECSCVars::TrackTransformChanges ? World->Clock.StepCount : 0;
 }
 
 void  CopyTransformToActorSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("CopyBack", 10000, sysScheduler);
+	builder.SetPhase(ESystemPhase::Frame);
 
 	
 	init_query(q_transform, sysScheduler->registry);
+	init_query(q_actors, sysScheduler->registry);
 
-	TaskDependencies deps1;
-	deps1.AddWrite < FActorTransform>();
+	//the packing reads the transform columns of the tables directly
+	TaskDependencies deps1 = TaskDependencies::FromQueries(q_transform);
 	deps1.AddRead<FScale>();
 	deps1.AddRead<FPosition>();
 	deps1.AddRead<FRotationComponent>();
-	deps1.AddRead<FActorReference>();
+	deps1.AddRead<FPreviousTransform>();
 
-	builder.AddTask(deps1,
-	//builder.AddSyncTask(
+	builder.AddParallelForIter(q_transform, deps1, [this](flecs::iter it, FActorTransform* t) {
+			PackTransforms(it, t);
+		});
+
+	//the actor list is a single array, so it gets filled after the packing on one thread
+	builder.AddTask(q_actors,
 		[=](ECS_Registry& reg) {
-			PackTransforms(reg);
+			GatherActorTransforms(reg);
 		}
 	);
 
-	builder.AddDependency("Movement");
-
 	SystemTaskBuilder builder2("Movement Apply", 11000, sysScheduler);
+	builder2.SetPhase(ESystemPhase::Frame);
 
-	builder2.AddGameTask(deps1,
+	//only touches the packed array, which CopyBack has finished with
+	builder2.AddGameTask(TaskDependencies{},
 		//builder.AddSyncTask(
 		[=](ECS_Registry& reg) {
 			SCOPE_CYCLE_COUNTER(STAT_CopyTransformActor);
@@ -673,15 +1041,51 @@ void  CopyTransformToActorSystem::schedule(ECSSystemScheduler* sysScheduler)
 					a.actor->SetActorTransform(a.transform);
 				}
 			}
-			transforms.Reset();
+			transforms.Reset(World->ScratchPad);
 		},ESysTaskFlags::NoECS
 	);
 	builder2.AddDependency("CopyBack");
-	builder.AddDependency("Movement");
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
 	sysScheduler->AddTaskgraph(builder2.FinishGraph());
 }
 
+void TransformInterpolationSystem::update(ECS_Registry& registry, float dt)
+{
+}
+
+void TransformInterpolationSystem::schedule(ECSSystemScheduler* sysScheduler)
+{
+	SystemTaskBuilder builder("StoreTransforms", 50, sysScheduler);
+
+	init_query(q_store, sysScheduler->registry);
+	init_query(q_drawn_meshes, sysScheduler->registry);
+	init_query(q_drawn_actors, sysScheduler->registry);
+
+	//everything that gets its transform drawn keeps the previous one
+	AddMissingComponent<FPreviousTransform>(builder, World, q_drawn_meshes);
+	AddMissingComponent<FPreviousTransform>(builder, World, q_drawn_actors);
+
+	//the rotation is optional, so the query has it as a pointer, but it only gets read.
+	//Declared by hand so the task doesnt count as writing the rotation of every drawn table
+	TaskDependencies storeDeps;
+	storeDeps.AddWrite<FPreviousTransform>();
+	storeDeps.AddRead<FPosition>();
+	storeDeps.AddRead<FRotationComponent>();
+
+	//has to run before anything moves in the step, the systems that write transforms depend on this chain
+	builder.AddParallelForEach(q_store, storeDeps,
+		[](auto e, FPreviousTransform& prev, const FPosition& pos, FRotationComponent* rot) {
+			prev.pos = pos.pos;
+			if (rot)
+			{
+				prev.rot = rot->rot;
+			}
+			prev.bValid = true;
+		});
+
+	sysScheduler->AddTaskgraph(builder.FinishGraph());
+}
+
 void CopyTransformToECSSystem::update(ECS_Registry& registry, float dt)
 {
 }
@@ -691,33 +1095,18 @@ void CopyTransformToECSSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("CopyTransform", 100, sysScheduler);
 	init_query(q_copyactor_tf, sysScheduler->registry);
-	//init_query(q_copyactor, sysScheduler->registry);
 
 
 	init_query(q_transforms, sysScheduler->registry);
 
-	TaskDependencies deps1;
-	deps1.AddWrite < FActorTransform>();
-	deps1.AddRead<FCopyTransformToECS>();
-	deps1.AddRead<FActorReference>();
+	builder.AddDependency("StoreTransforms");
 
-	TaskDependencies depsfirst;
+	init_query(q_copyactor, sysScheduler->registry);
 
-	depsfirst.AddWrite<ECS_Registry>();
+	//all movers get a transform component if they dont have one yet
+	AddMissingComponent<FActorTransform>(builder, World, q_copyactor);
 
-	builder.AddGameTask(depsfirst,
-		
-		[=](ECS_Registry& reg) {
-			SCOPE_CYCLE_COUNTER(STAT_CopyTransformECS);
-
-			//all movers get a transform component if they dont have one yet
-			auto raypos_filter = flecs::filter(reg).include<FCopyTransformToECS>().include<FActorReference>().exclude<FActorTransform>();
-
-			reg.add<FActorTransform>(raypos_filter);
-		}
-	);
-
-	builder.AddGameTask(deps1,
+	builder.AddGameTask(q_copyactor_tf,
 		[=](ECS_Registry& reg) {
 			SCOPE_CYCLE_COUNTER(STAT_CopyTransformECS);
 
@@ -732,14 +1121,8 @@ void CopyTransformToECSSystem::schedule(ECSSystemScheduler* sysScheduler)
 	);
 
 
-	TaskDependencies deps;
-	deps.AddWrite<FPosition>();
-	deps.AddWrite<FVelocity>();
-	deps.AddWrite<FScale>();
-	deps.AddRead<FActorTransform>();
-		
 	builder.AddTask(
-			deps,
+			q_transforms,
 			[=](ECS_Registry& reg) {
 
 				SCOPE_CYCLE_COUNTER(STAT_UnpackActorTransform);
@@ -758,6 +1141,7 @@ void CopyTransformToECSSystem::schedule(ECSSystemScheduler* sysScheduler)
 						sc->scale = transform.transform.GetScale3D();
 					}
 				});
+				World->TransformVersions.MarkQuery(q_transforms.c_ptr());
 			}
 	);
 
@@ -772,45 +1156,49 @@ void  MovementSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("Movement", 300, sysScheduler);
 
-	float dt = 1.0 / 60.0;
+	const ECSWorldClock* clock = &World->Clock;
 
 	init_query(q_positions, sysScheduler->registry);
 	init_query(q_moves, sysScheduler->registry);
 
-	TaskDependencies deps;
-	deps.AddWrite<FPosition>();
-	deps.AddWrite<FVelocity>();
-	deps.AddWrite<FLastPosition>();
-	deps.AddRead<FMovement>();
-	
 	builder.AddDependency("Boids");
 
-	builder.AddSyncTask(
-		[=](ECS_Registry& reg) {
+	init_query(q_raycasters, sysScheduler->registry);
+	sysScheduler->registry->component<FLastPosition>();
+	ECSCommandQueue* commands = &World->Commands;
 
-			//movement raycast gets a "last position" component
-			auto raypos_filter = flecs::filter(reg).include<FMovementRaycast>().include<FPosition>().exclude<FLastPosition>();
+	//movement raycast gets a "last position" component, starting from where it is now so the first ray doesnt come from the origin
+	builder.AddParallelForIter(q_raycasters, TaskDependencies::FromQueries(q_raycasters),
+		[commands](flecs::iter it, const FMovementRaycast* ray, const FPosition* pos) {
+			if (it.has_column<FLastPosition>()) return;
 
-			reg.add<FLastPosition>(raypos_filter);
-		}
-	);
-	builder.AddTask(
-		deps,
-		[=](ECS_Registry& reg) {
-			q_positions.each([&, dt](auto entity, FLastPosition& lastpos,const FPosition& pos) {
+			ECSCommandBuffer& cmd = commands->GetThreadBuffer();
+			for (auto i : it)
+			{
+				cmd.Set<FLastPosition>(it.entity(i).id(), FLastPosition(pos[i].pos));
+			}
+		});
+
+	//the last position has to be stored before anything moves, the chain keeps the two in order.
+	//only on the first substep, the raycasts go from the position before the whole frame
+	builder.AddParallelForEach(q_positions, TaskDependencies::FromQueries(q_positions),
+		[clock](auto entity, FLastPosition& lastpos, const FPosition& pos) {
+			if (clock->SubstepIndex == 0)
+			{
 				lastpos.pos = pos.pos;
-			});
+			}
+		});
 
-			q_moves.each([&, dt](auto entity, const FMovement& m, FPosition& pos, FVelocity& vel) {
+	builder.AddParallelForEach(q_moves, TaskDependencies::FromQueries(q_moves),
+		[clock](auto entity, const FMovement& m, FPosition& pos, FVelocity& vel) {
+			const float dt = clock->StepDeltaTime;
 
-				//gravity
-				const FVector gravity = FVector(0.f, 0.f, -980) * m.GravityStrenght;
-				vel.Add(gravity * dt);
+			//gravity
+			const FVector gravity = FVector(0.f, 0.f, -980) * m.GravityStrenght;
+			vel.Add(gravity * dt);
 
-				pos.Add(vel.vel * dt);
-			});
-		}
-	);
+			pos.Add(vel.vel * dt);
+		});
 
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
 }
@@ -836,17 +1224,13 @@ void DebugDrawSystem::update(ECS_Registry& registry, float dt)
 void  DebugDrawSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("DebugDraw", 10000, sysScheduler);
+	builder.SetPhase(ESystemPhase::Frame);
 
-	TaskDependencies deps;
-	deps.AddRead<FPosition>();
-	
-	deps.AddRead<FDebugSphere>();
-
-	query.init(*sysScheduler->registry);
+	init_query(query, sysScheduler->registry);
 
-	builder.AddGameTask(deps,
+	builder.AddGameTask(query,
 		[=](ECS_Registry& reg) {
-			this->update(reg, 1.0 / 60.0);
+			this->update(reg, World->Clock.FrameDeltaTime);
 		}
 	);
 
@@ -4,8 +4,10 @@
 #include "ECS_BaseComponents.h"
 #include "ECS_Archetype.h"
 #include "ECS_BattleComponents.h"
+#include "TimerWheel.h"
 #include "DrawDebugHelpers.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "ConvexVolume.h"
 #include "ParallelFor.h"
 DECLARE_CYCLE_STAT(TEXT("ECS: DebugDraw"), STAT_DebugDraw, STATGROUP_ECS);
 
@@ -32,10 +34,24 @@ struct MovementSystem :public System {
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
+	flecs::query<const FMovementRaycast, const FPosition> q_raycasters;
 	flecs::query<FLastPosition, const FPosition> q_positions;
 	flecs::query<const FMovement, FPosition,  FVelocity> q_moves;
 };
 
+//keeps the transform of the rendered entities from before each simulation step, so the draw can interpolate between steps
+struct TransformInterpolationSystem :public System {
+
+	void update(ECS_Registry &registry, float dt) override;
+
+
+	void schedule(ECSSystemScheduler* sysScheduler) override;
+
+	flecs::query<FPreviousTransform, const FPosition, FRotationComponent*> q_store;
+	flecs::query<const FPosition, const FInstancedStaticMesh> q_drawn_meshes;
+	flecs::query<const FPosition, const FCopyTransformToActor> q_drawn_actors;
+};
+
 DECLARE_CYCLE_STAT(TEXT("ECS: Copy Transform To ECS"), STAT_CopyTransformECS, STATGROUP_ECS);
 DECLARE_CYCLE_STAT(TEXT("ECS: Unpack Actor Transform"), STAT_UnpackActorTransform, STATGROUP_ECS);
 struct CopyTransformToECSSystem :public System {	
@@ -46,7 +62,7 @@ struct CopyTransformToECSSystem :public System {
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
 	//queries
-	//flecs::query<const FCopyTransformToECS, const FActorReference> q_copyactor;
+	flecs::query<const FCopyTransformToECS, const FActorReference> q_copyactor;
 	flecs::query<const FCopyTransformToECS, const FActorReference, FActorTransform> q_copyactor_tf;
 	
 	flecs::query<const FActorTransform, FPosition*, FRotationComponent*, FScale*> q_transforms;
@@ -58,7 +74,11 @@ struct CopyTransformToActorSystem :public System {
 
 	void update(ECS_Registry &registry, float dt) override;
 
-	void PackTransforms(ECS_Registry& registry);
+	//copies the transform columns of a table slice into the FActorTransform, if they changed since the last pack
+	void PackTransforms(flecs::iter& it, FActorTransform* t);
+
+	//collects the packed transforms of the entities that drive an actor, from the tables that changed
+	void GatherActorTransforms(ECS_Registry& registry);
 
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
@@ -68,9 +88,14 @@ struct CopyTransformToActorSystem :public System {
 		FTransform transform;		
 	};
 
-	TArray<ActorTransformParm> transforms;
+	//filled every frame from the frame arena
+	ECSFrameArray<ActorTransformParm> transforms;
+
+	//tables with transforms written on this step or after it get packed, see ECSTransformVersions
+	uint64 PackedStep = 0;
 
 	flecs::query<FActorTransform> q_transform;
+	flecs::query<const FActorTransform, const FActorReference, const FCopyTransformToActor> q_actors;
 	
 };
 
@@ -79,7 +104,20 @@ struct ArchetypeSpawnerSystem :public System {
 
 	TMap<TSubclassOf<AECS_Archetype>, AECS_Archetype*> Archetypes;
 
-	EntityHandle SpawnFromArchetype(ECS_Registry & registry,TSubclassOf<AECS_Archetype> &ArchetypeClass);
+	//spawns requested in one frame, grouped by archetype and by the components they override
+	struct SpawnBatch {
+		TSubclassOf<AECS_Archetype> ArchetypeClass;
+		bool bHasVelocity;
+		bool bHasFaction;
+		TArray<FPosition> Positions;
+		TArray<FVelocity> Velocities;
+		TArray<FFaction> Factions;
+	};
+
+	//finds the archetype actor of the class, spawning it the first time
+	AECS_Archetype* FindArchetype(TSubclassOf<AECS_Archetype> &ArchetypeClass);
+
+	void SpawnBatches(ECS_Registry& registry, TArray<SpawnBatch>& Batches);
 
 	void update(ECS_Registry &registry, float dt) override;
 
@@ -92,33 +130,112 @@ struct ArchetypeSpawnerSystem :public System {
 class StaticMeshDrawSystem :public System {
 public:
 
+	//Every drawn entity owns an instance slot of the ISM of its mesh, the instanceIndex of its FInstancedStaticMesh.
+	//Slots are dense: a removed entity gives its slot to the entity in the last one, so the ISM has as many instances as there are entities
+	//Every mesh also has a tag entity, added to the entities that draw it, so each table only holds one mesh
+	//and the pack finds the ISM once per table.
 	struct ISMData {
 		UInstancedStaticMeshComponent* ISM;
-		int rendered;
+		UStaticMesh* Mesh;
+		EntityID MeshTag;
+		//entity in each slot
+		TArray<EntityID> SlotOwners;
+		//transform of each slot, written by the pack. Only the dirty slots get uploaded to the ISM
+		TArray<FTransform> Transforms;
+		//ESlotState flags of each slot
+		TArray<uint8> SlotStates;
+		//slots that hold the zero scale transform of a culled instance
+		int32 NumHidden;
+		//radius of the bounding sphere of the mesh, before the scale of the instance
+		float BoundsRadius;
+	};
+
+	enum ESlotState : uint8 {
+		//the slot transform changed since the last upload
+		SlotDirty = 1 << 0,
+		//the instance was culled, the slot has the zero scale transform
+		SlotHidden = 1 << 1,
 	};
 
+	//clean slots between two dirty ones that still get uploaded as part of the same batch, instead of starting another one
+	static constexpr int32 MaxUploadGap = 16;
+
+	//view the instances get culled against, taken on the game thread at the start of every draw
+	struct CullView {
+		FConvexVolume Frustum;
+		FMatrix ViewProjection;
+		FVector Origin;
+		//0 for no distance limit
+		float MaxDistance;
+		bool bFrustum;
+		//false when there is no player view, nothing gets culled then
+		bool bValid;
+	};
+	CullView View;
+	//the view is not the same as in the last draw, so the visibility of every instance is tested again
+	bool bViewChanged = true;
+
+	//tables with transforms written on this step or after it get packed, see ECSTransformVersions
+	uint64 PackedStep = 0;
+
+	//instances of the last draw, the stats are only there with stats enabled
+	int32 NumSubmitted = 0;
+	int32 NumCulled = 0;
+	//transform of a batch of dirty slots on its way to the ISM
+	TArray<FTransform> UploadBatch;
+
 	UInstancedStaticMeshComponent * ISM;
 	TMap<UStaticMesh*, ISMData> MeshMap;
 	
 
 	int render = 0;
-	float Elapsed{5.f};	
 
 	ISMData * GetInstancedMeshForMesh(UStaticMesh * mesh);
 
-	void initialize(AActor * _Owner, ECS_World * _World) override{
-		
-		OwnerActor = _Owner;	
-		World = _World;
-		ISM = nullptr;		
-	}	
+	void initialize(AActor * _Owner, ECS_World * _World) override;
+
+	//gives the entity a slot in the ISM of its mesh, unless it already has one there
+	void AcquireSlot(EntityID Entity, FInstancedStaticMesh& Mesh);
+	//the entity in the last slot of the ISM moves into the freed one
+	void ReleaseSlot(ECS_Registry& registry, ISMData& MeshData, int32 Slot);
 
 	void update(ECS_Registry &registry,float dt) override;
 
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
-	void pack_transforms();
+	//copies the transform columns of a table slice into the RenderTransform
+	void pack_transforms(flecs::iter& it, FInstancedStaticMesh* t);
+
+	//reads the view of the first local player, and checks if it changed since the last draw
+	void CaptureView();
+
+	//true when the bounding sphere of the instance is inside the draw distance and the frustum
+	bool IsVisible(const FTransform& Transform, float BoundsRadius) const {
+		if (!View.bValid) return true;
+
+		const FVector Center = Transform.GetLocation();
+		const float Radius = BoundsRadius * Transform.GetMaximumAxisScale();
+		if (View.MaxDistance > 0.f && FVector::DistSquared(Center, View.Origin) > FMath::Square(View.MaxDistance + Radius))
+		{
+			return false;
+		}
+		return !View.bFrustum || View.Frustum.IntersectSphere(Center, Radius);
+	}
+
+	//packs a table slice and writes the transforms into the slots of the entities.
+	//Culled instances keep their slot and get a zero scale transform, so the ISM doesnt draw them.
+	//Tables that didnt change are skipped, or only checked for instances that went in or out of view if the view moved
+	void WriteInstances(flecs::iter& it, FInstancedStaticMesh* t);
+
+	//mesh of the tag the table has, null for tables that arent tagged yet
+	ISMData* FindTableMesh(ecs_type_t type);
+
+	//gives the entities the tag of their mesh and takes away the tags of other meshes
+	void RetagEntities(ECS_Registry& registry, const TArray<EntityID>& Entities);
+
+	//matches the instance count of the ISM to its slots, and sends the transforms of the dirty slots in batches of consecutive slots
+	void UploadInstances(ISMData& MeshData);
 
 	flecs::query<FInstancedStaticMesh> q_transform;
 };
@@ -130,7 +247,8 @@ struct RaycastSystem :public System {
 
 	void CheckRaycasts(ECS_Registry& registry, float dt, UWorld* GameWorld);
 
-	void CreateExplosion(ECS_Registry& registry, EntityID entity, FVector ExplosionPoint);
+	//records the spawner entity of the explosion
+	void CreateExplosion(ECSCommandBuffer& cmd, const FProjectile& projectile, FVector ExplosionPoint);
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
@@ -156,7 +274,6 @@ struct RaycastSystem :public System {
 	};
 
 	TArray<RaycastRequest> rayRequests;
-	TArray<RaycastUnit> rayUnits;
 	moodycamel::ConcurrentQueue<ExplosionStr> explosions;
 	moodycamel::ConcurrentQueue<ActorBpCall> actorCalls;
 
@@ -168,8 +285,14 @@ struct LifetimeSystem :public System {
 
 	static constexpr int DeletionSync = 200000;
 
+	//entities with a lifetime, keyed by the step they expire on
+	ECSTimerWheel Expiries;
+	void initialize(AActor* _Owner, ECS_World* _World) override;
+
 	void update(ECS_Registry &registry, float dt) override;
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
+	void ScheduleExpiry(EntityID Entity, FLifetime& Lifetime);
+
 	flecs::query<FLifetime> q_lifetime;
 };
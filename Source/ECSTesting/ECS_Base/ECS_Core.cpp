@@ -2,9 +2,18 @@
 
 #include "SystemTasks.h"
 
+System::~System()
+{
+	for (EntityID trigger : OwnedTriggers)
+	{
+		ecs_delete(World->GetRegistry()->c_ptr(), trigger);
+	}
+}
+
 void ECS_World::UpdateSystems(float DeltaTime)
 {
 	SCOPE_CYCLE_COUNTER(STAT_TotalUpdate);
+	ScratchPad.Reset();
 
 	for (auto s : systems)
 	{
@@ -12,36 +21,35 @@ void ECS_World::UpdateSystems(float DeltaTime)
 	}
 }
 
-System* ECS_World::GetSystem(FString name)
-{
-	return namedSystems[name];
-}
-
-void ECS_World::UpdateSystem(FString name, float Dt)
+void ECSWorldClock::Advance(float DeltaTime, float StepTime, int32 MaxSubsteps)
 {
-	GetSystem(name)->update(registry, Dt);
-}
-
-struct DeletionContextHold {
-	TSharedPtr<DeletionContext> ctx;
-};
+	StepDeltaTime = FMath::Max(StepTime, 0.001f);
+	FrameDeltaTime = DeltaTime;
+	Accumulator += FMath::Max(DeltaTime, 0.f);
 
-DeletionContext* DeletionContext::GetFromRegistry(ECS_Registry& registry)
-{
-	if (registry.has<DeletionContextHold>())
+	NumSubsteps = 0;
+	while (Accumulator >= StepDeltaTime && NumSubsteps < MaxSubsteps)
 	{
-		return registry.get<DeletionContextHold>()->ctx.Get();
+		Accumulator -= StepDeltaTime;
+		NumSubsteps++;
 	}
-	else {
-		DeletionContextHold holder;
-		holder.ctx = TSharedPtr<DeletionContext>(new DeletionContext());
 
-		registry.set<DeletionContextHold>(std::move(holder));
+	//the simulation cant keep up, drop the whole steps left instead of carrying them into the next frames
+	if (Accumulator >= StepDeltaTime)
+	{
+		Accumulator = FMath::Fmod(Accumulator, StepDeltaTime);
 	}
-	return nullptr;
+
+	SubstepIndex = 0;
+	InterpolationAlpha = FMath::Clamp(Accumulator / StepDeltaTime, 0.f, 1.f);
+}
+
+System* ECS_World::GetSystem(FString name)
+{
+	return namedSystems[name];
 }
 
-void DeletionContext::AddToQueue(EntityID entity)
+void ECS_World::UpdateSystem(FString name, float Dt)
 {
-	entitiesToDelete.enqueue(entity);
+	GetSystem(name)->update(registry, Dt);
 }
@@ -7,8 +7,11 @@
 #include "flecs/flecs.h"
 #include "concurrentqueue.h"
 #include <vector>
+#include <algorithm>
 #include "ECSTesting.h"
 #include "LinearMemory.h"
+#include "TransformVersions.h"
+#include "CommandBuffer.h"
 #include "Map.h"
 #include "String.h"
 DECLARE_CYCLE_STAT(TEXT("ECS: Total System Update"), STAT_TotalUpdate, STATGROUP_ECS);
@@ -31,7 +34,8 @@ struct System {
 	AActor* OwnerActor;
 	ECS_World* World;
 	FString name;
-	virtual ~System() {}
+	//deletes the triggers of the system
+	virtual ~System();
 	virtual void initialize(AActor* _Owner, ECS_World* _World) {
 		OwnerActor = _Owner;
 		World = _World;
@@ -42,13 +46,20 @@ struct System {
 	{
 		
 	};
-};
 
-struct DeletionContext {
-	moodycamel::ConcurrentQueue<EntityID> entitiesToDelete;
+	//Body has the signature of a flecs trigger, (flecs::iter it, T* values). It runs when T gets set on entities, by hand or through a spawn,
+	//on the game thread when the commands are applied. The entities that already have T go through Body right away.
+	//The trigger belongs to the system, and gets deleted with it
+	template<typename T, typename Func>
+	void AddSetTrigger(Func Body);
+
+	//same, for entities that lose T or get destroyed with it. Nothing runs for the entities that have T already
+	template<typename T, typename Func>
+	void AddRemoveTrigger(Func Body);
 
-	static DeletionContext* GetFromRegistry(ECS_Registry& registry);
-	void AddToQueue(EntityID entity);
+private:
+	//triggers point back to the system, and the registry outlives it
+	TArray<EntityID> OwnedTriggers;
 };
 
 template<typename T, typename Traits, typename F>
@@ -71,6 +82,32 @@ void bulk_dequeue(moodycamel::ConcurrentQueue<T, Traits>& queue, F&& fun) {
 	}
 };
 
+//Fixed timestep clock. Real frame time accumulates and is consumed in steps of StepDeltaTime,
+//whatever is left over is the fraction of a step the renderer interpolates by.
+struct ECSWorldClock {
+	//duration of one simulation step, the dt every simulation system uses
+	float StepDeltaTime{ 1.f / 60.f };
+	//real time of the current frame
+	float FrameDeltaTime{ 0.f };
+	//simulation steps to run this frame, can be 0 on fast frames
+	int32 NumSubsteps{ 0 };
+	//index of the step being simulated
+	int32 SubstepIndex{ 0 };
+	//simulation steps run since the world started, counting the one being simulated. Steps are numbered from 1
+	uint64 StepCount{ 0 };
+	//how far the frame is between the last two simulation steps, 0 to 1
+	float InterpolationAlpha{ 0.f };
+	float Accumulator{ 0.f };
+
+	//step on which a timer that starts now runs out, if it loses StepDeltaTime every step and runs out once it goes below 0
+	uint64 StepAfter(float Time) const {
+		return StepCount + uint64(FMath::Max(FMath::FloorToInt(Time / StepDeltaTime), 0)) + 1;
+	}
+
+	//adds the frame time and works out the steps to run. Time past MaxSubsteps is dropped so a slow frame cant spiral
+	void Advance(float DeltaTime, float StepTime, int32 MaxSubsteps);
+};
+
 class ECS_World {
 public:
 	~ECS_World() {
@@ -78,13 +115,13 @@ public:
 		{
 			delete s;
 		}
-		FreeLinearMemory(ScratchPad);
 	}
 
 	void InitializeSystems(AActor* _Owner)
 	{
 		//allocate 10 mb
-		ScratchPad = AllocateLinearMemory(MEGABYTE * 10);
+		ScratchPad.Initialize(MEGABYTE * 10);
+		TransformVersions.Initialize(registry);
 
 		Owner = _Owner;
 		for (auto s : systems)
@@ -106,6 +143,7 @@ public:
 			s->name = name;
 			systems.push_back(s);
 			namedSystems.Add(name, s);
+			SystemsVersion++;
 		}
 		return s;
 	}
@@ -120,6 +158,7 @@ public:
 			s->name = "Unnamed";
 			systems.push_back(s);
 			//namedSystems.Add(name, s);
+			SystemsVersion++;
 		}
 		return s;
 	}
@@ -127,7 +166,27 @@ public:
 	void RegisterSystem(System* newSystem, FString name)
 	{
 		systems.push_back(newSystem);
-		namedSystems[name] = newSystem;
+		namedSystems.Add(name, newSystem);
+		SystemsVersion++;
+	}
+
+	//removes and deletes the system, the task graph gets rebuilt on the next update
+	void UnregisterSystem(System* oldSystem)
+	{
+		auto it = std::find(systems.begin(), systems.end(), oldSystem);
+		if (it != systems.end())
+		{
+			systems.erase(it);
+			for (auto It = namedSystems.CreateIterator(); It; ++It)
+			{
+				if (It.Value() == oldSystem)
+				{
+					It.RemoveCurrent();
+				}
+			}
+			delete oldSystem;
+			SystemsVersion++;
+		}
 	}
 	EntityHandle NewEntity() {
 		EntityHandle h;
@@ -146,7 +205,16 @@ public:
 	ECS_Registry *GetRegistry() { return &registry; };
 	FRandomStream rng;
 
-	LinearMemory ScratchPad;
+	//temporary memory of the frame, reset at the start of every update
+	ECSFrameArena ScratchPad;
+
+	ECSWorldClock Clock;
+
+	//which tables had their transforms written on which step, stamped from the clock
+	ECSTransformVersions TransformVersions{ &Clock };
+
+	//structural changes recorded by the tasks, applied by the scheduler after each phase
+	ECSCommandQueue Commands;
 
 public:
 
@@ -154,8 +222,33 @@ public:
 
 	std::vector<System*> systems;
 	TMap<FString, System*> namedSystems;
+	//bumped every time a system is added or removed, so the scheduler knows when to recompile its graph
+	int SystemsVersion = 0;
 	ECS_Registry registry;	
 };
+template<typename T, typename Func>
+void System::AddSetTrigger(Func Body)
+{
+	ECS_Registry& reg = *World->GetRegistry();
+
+	flecs::system<T> trigger(reg);
+	trigger.kind(flecs::OnSet).iter(Body);
+	OwnedTriggers.Add(trigger.id());
+
+	//entities that got T before the trigger existed
+	flecs::query<T> existing(reg);
+	existing.iter(Body);
+	ecs_query_free(existing.c_ptr());
+}
+
+template<typename T, typename Func>
+void System::AddRemoveTrigger(Func Body)
+{
+	flecs::system<T> trigger(*World->GetRegistry());
+	trigger.kind(flecs::OnRemove).iter(Body);
+	OwnedTriggers.Add(trigger.id());
+}
+
 template<typename C>
 void init_comp(ECS_World* world, EntityHandle et, C Value)
 {
@@ -0,0 +1,210 @@
+#include "LinearMemory.h"
+#include "ECSTesting.h"
+#include "HAL/PlatformTLS.h"
+#include "Misc/ScopeLock.h"
+
+DECLARE_MEMORY_STAT(TEXT("ECS: Frame Arena Last Frame"), STAT_FrameArenaLastFrame, STATGROUP_ECS);
+DECLARE_MEMORY_STAT(TEXT("ECS: Frame Arena High Water"), STAT_FrameArenaHighWater, STATGROUP_ECS);
+DECLARE_MEMORY_STAT(TEXT("ECS: Frame Arena Overflow"), STAT_FrameArenaOverflow, STATGROUP_ECS);
+
+ECSFrameArena::ECSFrameArena()
+{
+	TlsSlot = FPlatformTLS::AllocTlsSlot();
+}
+
+ECSFrameArena::~ECSFrameArena()
+{
+	auto freeChain = [](Region& R) {
+		Block* b = R.First;
+		while (b)
+		{
+			Block* next = b->Next;
+			if (b->bOwned)
+			{
+				FMemory::Free(b);
+			}
+			b = next;
+		}
+	};
+
+	const int32 numRegions = FMath::Min(NumRegions.load(), MaxRegions);
+	for (int32 i = 0; i < numRegions; i++)
+	{
+		freeChain(Regions[i]);
+	}
+	freeChain(SharedRegion);
+
+	if (Base.pointer)
+	{
+		FreeLinearMemory(Base);
+	}
+	FPlatformTLS::FreeTlsSlot(TlsSlot);
+}
+
+void ECSFrameArena::Initialize(size_t BaseSize)
+{
+	check(NumRegions.load() == 0 && !Base.pointer);
+	Base = AllocateLinearMemory(BaseSize);
+	BaseOffset = 0;
+}
+
+void* ECSFrameArena::Allocate(size_t Size, size_t Alignment)
+{
+	checkSlow(FMath::IsPowerOfTwo(Alignment));
+
+	Region* R = FindRegion();
+	if (!R)
+	{
+		FScopeLock lock(&SharedLock);
+		return AllocateFrom(SharedRegion, Size, Alignment);
+	}
+	return AllocateFrom(*R, Size, Alignment);
+}
+
+ECSFrameArena::Region* ECSFrameArena::FindRegion()
+{
+	const uint32 threadId = FPlatformTLS::GetCurrentThreadId();
+
+	//the slot can be left over from another arena that had the same one, so the region has to belong to this thread
+	const int32 index = int32(UPTRINT(FPlatformTLS::GetTlsValue(TlsSlot))) - 1;
+	if (index == MaxRegions)
+	{
+		return nullptr;
+	}
+	if (index >= 0 && index < FMath::Min(NumRegions.load(std::memory_order_acquire), MaxRegions) && Regions[index].ThreadId == threadId)
+	{
+		return &Regions[index];
+	}
+
+	const int32 claimed = NumRegions.fetch_add(1);
+	if (claimed >= MaxRegions)
+	{
+		//remembered so the thread goes straight to the shared region from now on
+		FPlatformTLS::SetTlsValue(TlsSlot, reinterpret_cast<void*>(UPTRINT(MaxRegions + 1)));
+		return nullptr;
+	}
+
+	Region& R = Regions[claimed];
+	R.ThreadId = threadId;
+	FPlatformTLS::SetTlsValue(TlsSlot, reinterpret_cast<void*>(UPTRINT(claimed + 1)));
+	return &R;
+}
+
+ECSFrameArena::Block* ECSFrameArena::NewBlock(size_t Size)
+{
+	const size_t sliceSize = sizeof(Block) + Size;
+
+	//regions start with a slice of the base memory while there is some left
+	Block* block = nullptr;
+	if (Size == RegionSize && Base.pointer)
+	{
+		const size_t offset = BaseOffset.fetch_add(sliceSize);
+		if (offset + sliceSize <= Base.size)
+		{
+			block = reinterpret_cast<Block*>(static_cast<uint8*>(Base.pointer) + offset);
+			block->bOwned = false;
+		}
+	}
+
+	if (!block)
+	{
+		block = static_cast<Block*>(FMemory::Malloc(sliceSize, alignof(Block)));
+		block->bOwned = true;
+		OverflowBytes += sliceSize;
+	}
+
+	block->Next = nullptr;
+	block->Size = Size;
+	return block;
+}
+
+void* ECSFrameArena::AllocateFrom(Region& R, size_t Size, size_t Alignment)
+{
+	if (R.Current)
+	{
+		const UPTRINT start = UPTRINT(R.Current->Data());
+		const UPTRINT aligned = Align(start + R.Offset, Alignment);
+		const size_t end = size_t(aligned - start) + Size;
+		if (end <= R.Current->Size)
+		{
+			R.Offset = end;
+			return reinterpret_cast<void*>(aligned);
+		}
+	}
+	return AllocateSlow(R, Size, Alignment);
+}
+
+void* ECSFrameArena::AllocateSlow(Region& R, size_t Size, size_t Alignment)
+{
+	//worst case padding, so the allocation fits in the block wherever it starts
+	const size_t needed = Size + Alignment;
+
+	if (!R.First)
+	{
+		R.First = NewBlock(needed <= RegionSize ? RegionSize : needed);
+		R.Current = R.First;
+		R.Offset = 0;
+		return AllocateFrom(R, Size, Alignment);
+	}
+
+	//the blocks chained in older frames are reused first
+	R.UsedBefore += R.Offset;
+	while (R.Current->Next)
+	{
+		R.Current = R.Current->Next;
+		R.Offset = 0;
+		if (needed <= R.Current->Size)
+		{
+			return AllocateFrom(R, Size, Alignment);
+		}
+	}
+
+	//each block doubles the last one, so a region needs few of them to reach the size of a frame
+	Block* block = NewBlock(FMath::Max(R.Current->Size * 2, needed));
+	R.Current->Next = block;
+	R.Current = block;
+	R.Offset = 0;
+	return AllocateFrom(R, Size, Alignment);
+}
+
+void ECSFrameArena::Reset()
+{
+	size_t used = 0;
+	auto resetRegion = [&](Region& R) {
+		used += RegionUsed(R);
+		R.Current = R.First;
+		R.Offset = 0;
+		R.UsedBefore = 0;
+	};
+
+	const int32 numRegions = FMath::Min(NumRegions.load(), MaxRegions);
+	for (int32 i = 0; i < numRegions; i++)
+	{
+		resetRegion(Regions[i]);
+	}
+	resetRegion(SharedRegion);
+
+	LastFrameBytes = used;
+	HighWaterBytes = FMath::Max(HighWaterBytes, used);
+
+	SET_MEMORY_STAT(STAT_FrameArenaLastFrame, LastFrameBytes);
+	SET_MEMORY_STAT(STAT_FrameArenaHighWater, HighWaterBytes);
+	SET_MEMORY_STAT(STAT_FrameArenaOverflow, OverflowBytes.load());
+}
+
+ECSFrameArena::Stats ECSFrameArena::GetStats() const
+{
+	Stats stats;
+	const int32 numRegions = FMath::Min(NumRegions.load(), MaxRegions);
+
+	stats.UsedBytes = RegionUsed(SharedRegion);
+	for (int32 i = 0; i < numRegions; i++)
+	{
+		stats.UsedBytes += RegionUsed(Regions[i]);
+	}
+	stats.LastFrameBytes = LastFrameBytes;
+	stats.HighWaterBytes = FMath::Max(HighWaterBytes, stats.UsedBytes);
+	stats.OverflowBytes = OverflowBytes.load();
+	stats.NumRegions = numRegions;
+	return stats;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "CoreMinimal.h"
+#include <atomic>
 
 //linear "vector" type thing, can be reset instantly to whatever
 
@@ -25,26 +27,156 @@ static LinearMemory AllocateLinearMemory(size_t size)
 	return m;
 }
 
+//Bump allocator for memory that only has to live until the next frame starts.
+//Every thread bumps through its own region, so allocating never takes a lock. A region starts with a slice of the base memory,
+//and when a block runs out a new one gets chained after it. The chains are kept between frames,
+//so once they are big enough for the heaviest frame nothing is allocated anymore.
+//Reset can only be called while no other thread uses the arena, it frees everything allocated before it at once.
+class ECSFrameArena {
+public:
+	//threads past this share one region behind a lock
+	static constexpr int32 MaxRegions = 64;
+	//slice of the base memory every region starts with
+	static constexpr size_t RegionSize = 256 * KILOBYTE;
+	static constexpr size_t DefaultAlignment = 16;
+
+	struct Stats {
+		//bytes handed out since the last reset, alignment padding included
+		size_t UsedBytes;
+		//bytes handed out in the last frame
+		size_t LastFrameBytes;
+		//most bytes handed out in a single frame
+		size_t HighWaterBytes;
+		//bytes of the blocks that didnt fit in the base memory
+		size_t OverflowBytes;
+		int32 NumRegions;
+	};
+
+	ECSFrameArena();
+	~ECSFrameArena();
+
+	ECSFrameArena(const ECSFrameArena&) = delete;
+	ECSFrameArena& operator=(const ECSFrameArena&) = delete;
+
+	//allocates the base memory the regions are carved from. Has to be called before anything is allocated
+	void Initialize(size_t BaseSize);
+
+	//thread safe. Alignment has to be a power of two
+	void* Allocate(size_t Size, size_t Alignment = DefaultAlignment);
+
+	//uninitialized memory for Count items
+	template<typename T>
+	T* AllocateArray(int32 Count) {
+		return static_cast<T*>(Allocate(sizeof(T) * FMath::Max(Count, 0), FMath::Max<size_t>(alignof(T), 1)));
+	}
+
+	//starts a new frame, every allocation of the old one is invalid after this
+	void Reset();
+
+	//the used bytes are only exact while no other thread is allocating
+	Stats GetStats() const;
+
+private:
+	//header at the start of every block, the memory of the block follows it
+	struct Block {
+		Block* Next;
+		size_t Size;
+		//false for the slices of the base memory
+		bool bOwned;
+
+		uint8* Data() { return reinterpret_cast<uint8*>(this + 1); }
+	};
+
+	struct alignas(PLATFORM_CACHE_LINE_SIZE) Region {
+		Block* First{ nullptr };
+		Block* Current{ nullptr };
+		//bump offset into the current block
+		size_t Offset{ 0 };
+		//bytes used in the blocks before the current one
+		size_t UsedBefore{ 0 };
+		uint32 ThreadId{ 0 };
+	};
+
+	//region of the calling thread, claims one the first time. Null for the threads that use the shared region
+	Region* FindRegion();
+	Block* NewBlock(size_t Size);
+	void* AllocateFrom(Region& R, size_t Size, size_t Alignment);
+	//moves the region to a block the allocation fits in, chaining a new one if needed
+	void* AllocateSlow(Region& R, size_t Size, size_t Alignment);
+	static size_t RegionUsed(const Region& R) { return R.UsedBefore + R.Offset; }
+
+	LinearMemory Base{ nullptr, 0 };
+	std::atomic<size_t> BaseOffset{ 0 };
+
+	Region Regions[MaxRegions];
+	std::atomic<int32> NumRegions{ 0 };
+	//holds the index of the region of every thread, plus one
+	uint32 TlsSlot;
+
+	Region SharedRegion;
+	FCriticalSection SharedLock;
+
+	std::atomic<size_t> OverflowBytes{ 0 };
+	size_t LastFrameBytes{ 0 };
+	size_t HighWaterBytes{ 0 };
+};
+
+//Growable array on a frame arena, for the temporary lists of a frame. Growing leaves the old storage to the arena.
+//The items are never destroyed, so they have to be trivially destructible
 template<typename T>
-struct TypedLinearMemory {
+class ECSFrameArray {
+	static_assert(TIsTriviallyDestructible<T>::Value, "frame arrays never destroy their items");
+public:
+	ECSFrameArray() = default;
+	explicit ECSFrameArray(ECSFrameArena& InArena, int32 InitialCapacity = 0) {
+		Reset(InArena, InitialCapacity);
+	}
 
-	TypedLinearMemory(LinearMemory & mem) {
-		pointer = static_cast<T*>(mem.pointer);
-		
-		last = 0;
+	//empties the array. The storage is dropped too, it can be from an older frame of the arena
+	void Reset(ECSFrameArena& InArena, int32 InitialCapacity = 0) {
+		Arena = &InArena;
+		Data = InitialCapacity > 0 ? Arena->AllocateArray<T>(InitialCapacity) : nullptr;
+		Count = 0;
+		Capacity = InitialCapacity;
 	}
 
-	void push_back(const T&Item)
-	{
-		pointer[last] = Item;
-		last++;
+	void Add(const T& Item) {
+		if (Count == Capacity) {
+			Grow();
+		}
+		new(&Data[Count++]) T(Item);
 	}
-	T &operator[](size_t i){
-		return pointer[i];
+
+	int32 Num() const { return Count; }
+
+	T& operator[](int32 Index) {
+		checkSlow(Index >= 0 && Index < Count);
+		return Data[Index];
+	}
+	const T& operator[](int32 Index) const {
+		checkSlow(Index >= 0 && Index < Count);
+		return Data[Index];
 	}
 
-	T * pointer;
-	size_t last;	
+	T* begin() { return Data; }
+	T* end() { return Data + Count; }
+	const T* begin() const { return Data; }
+	const T* end() const { return Data + Count; }
 
-};
+private:
+	void Grow() {
+		check(Arena);
+		const int32 NewCapacity = FMath::Max(Capacity * 2, 16);
+		T* NewData = Arena->AllocateArray<T>(NewCapacity);
+		if (Count > 0) {
+			FMemory::Memcpy(NewData, Data, sizeof(T) * Count);
+		}
+		Data = NewData;
+		Capacity = NewCapacity;
+	}
 
+	ECSFrameArena* Arena{ nullptr };
+	T* Data{ nullptr };
+	int32 Count{ 0 };
+	int32 Capacity{ 0 };
+};
@@ -1,16 +1,20 @@
 #include "SystemTasks.h"
-#include <fstream>
-
-DECLARE_CYCLE_STAT(TEXT("TaskSys: SyncPoint"), STAT_TS_SyncPoint, STATGROUP_ECS);
-DECLARE_CYCLE_STAT(TEXT("TaskSys: GameTask"), STAT_TS_GameTask, STATGROUP_ECS);
-DECLARE_CYCLE_STAT(TEXT("TaskSys: AsyncTask"), STAT_TS_AsyncTask, STATGROUP_ECS);
+#include "TaskExecutor.h"
+#include "TaskTrace.h"
+#include "ECS_BaseComponents.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
 
+DECLARE_CYCLE_STAT(TEXT("TaskSys: SyncLoop"), STAT_TS_SyncLoop, STATGROUP_ECS);
 
-DECLARE_CYCLE_STAT(TEXT("TaskSys: TaskEnd1"), STAT_TS_End1, STATGROUP_ECS);
+int32 ComponentTypeId::Next()
+{
+	static std::atomic<int32> counter{ 0 };
 
-DECLARE_CYCLE_STAT(TEXT("TaskSys: TaskEnd2"), STAT_TS_End2, STATGROUP_ECS);
-DECLARE_CYCLE_STAT(TEXT("TaskSys: WaitTime"), STAT_TS_Wait, STATGROUP_ECS);
-DECLARE_CYCLE_STAT(TEXT("TaskSys: SyncLoop"), STAT_TS_SyncLoop, STATGROUP_ECS);
+	const int32 id = counter++;
+	checkf(id < MaxComponents, TEXT("Too many component types used in task dependencies, raise ComponentTypeId::MaxComponents"));
+	return id;
+}
 
 SystemTask* nextTask(SystemTask* task) {
 	if (task->next) { return task->next; }
@@ -41,26 +45,76 @@ void ECSSystemScheduler::AddTaskgraph(SystemTaskChain* newGraph)
 	this->systasks.Add(newGraph);
 }
 
-void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
+bool ECSSystemScheduler::NeedsRebuild(const ECS_World* world) const
+{
+	return !bCompiled || compiledSystemsVersion != world->SystemsVersion;
+}
+
+void ECSSystemScheduler::Rebuild(ECS_World* world)
+{
+	Reset();
+	registry = world->GetRegistry();
+
+	transformVersions = &world->TransformVersions;
+	transformWrites = ComponentMask{};
+	transformWrites.Set(ComponentTypeId::Get<FPosition>());
+	transformWrites.Set(ComponentTypeId::Get<FRotationComponent>());
+	transformWrites.Set(ComponentTypeId::Get<FScale>());
+
+	for (auto sys : world->systems) {
+		sys->schedule(this);
+	}
+
+	Compile();
+	compiledSystemsVersion = world->SystemsVersion;
+}
+
+void ECSSystemScheduler::Compile()
 {
-	registry = &reg;
 	systasks.Sort([](const SystemTaskChain& tskA, const  SystemTaskChain& tskB) {
 		return tskA.sortKey < tskB.sortKey;
 		});
 
+	//every phase is its own graph. Dependencies on a chain of another phase are already met by the order the phases run in
+	for (int32 phase = 0; phase < (int32)ESystemPhase::Count; phase++) {
+		TArray<SystemTaskChain*> chains;
+		for (auto chain : systasks) {
+			if ((int32)chain->phase == phase) {
+				chains.Add(chain);
+			}
+		}
+		CompilePhase(chains, graphs[phase]);
+	}
+	bCompiled = true;
+
+	//the graph goes next to the traces, so the task names in them can be matched with the graph
+	if (Trace)
+	{
+		WriteGraphviz(FPaths::Combine(Trace->GetOutputDir(), TEXT("TaskGraph.dot")));
+	}
+}
+
+void ECSSystemScheduler::CompilePhase(TArray<SystemTaskChain*>& chains, CompiledGraph& graph)
+{
+	auto newTask = [&](SystemTask* original) {
+		GraphTask* task = NewGraphTask(original);
+		graph.tasks.Add(task);
+		return task;
+	};
+
 	//fix dependencies
 	auto find_index = [&](const FString& name) -> int {
-		for (int i = 0; i < systasks.Num(); i++) {
-			if (systasks[i]->name == name) return i;
+		for (int i = 0; i < chains.Num(); i++) {
+			if (chains[i]->name == name) return i;
 		}
 		return 0;
 	};
 
-	for (int i = 0; i < systasks.Num() - 1; i++) {
-		if (systasks[i]->SystemDependencies.Num() > 0) {
+	for (int i = 0; i < chains.Num() - 1; i++) {
+		if (chains[i]->SystemDependencies.Num() > 0) {
 			int minindex = 0;
 			//find the min index we need this task to be at
-			for (auto& n : systasks[i]->SystemDependencies)
+			for (auto& n : chains[i]->SystemDependencies)
 			{
 				minindex = FMath::Max(minindex, find_index(n));
 			}
@@ -68,13 +122,13 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 			//the task is below its dependencies
 			if (minindex > i) {
 				//reshuffle the array
-				SystemTaskChain* movechain = systasks[i];
+				SystemTaskChain* movechain = chains[i];
 
 				//move all one down to cover the slot
-				for (int j = i; j <= minindex; j++) {
-					systasks[j] = systasks[j + 1];
+				for (int j = i; j < minindex; j++) {
+					chains[j] = chains[j + 1];
 				}
-				systasks[minindex] = movechain;
+				chains[minindex] = movechain;
 
 				i--;
 			}
@@ -83,21 +137,18 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 
 
 	//schedule all the taskchains into a proper task graph
-	TArray<GraphTask*> createdTasks;
+	graph.rootTask = newTask(nullptr);
 
-	
-	GraphTask* rootTask = NewGraphTask(nullptr);
-
-	GraphTask* lastSyncTask = rootTask;
+	GraphTask* lastSyncTask = graph.rootTask;
 
 	TArray<GraphTask*> unconnectedTasks;
 
-	for (int i = 0; i < systasks.Num(); i++)
+	for (int i = 0; i < chains.Num(); i++)
 	{
-		SystemTaskChain* chain = systasks[i];
+		SystemTaskChain* chain = chains[i];
 
 		int cindex = 0;
-		GraphTask* task = NewGraphTask(chain->firstTask);
+		GraphTask* task = newTask(chain->firstTask);
 		task->chainIndex = cindex;
 		lastSyncTask->AddSuccesor(task);
 	
@@ -115,7 +166,7 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 			}
 
 			if (task->original->next) {
-				GraphTask* newtask = NewGraphTask(task->original->next);
+				GraphTask* newtask = newTask(task->original->next);
 				newtask->chainIndex = cindex;
 				task->AddSuccesor(newtask);
 				task = newtask;
@@ -129,9 +180,7 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 	}
 
 
-	//graphviz
-	FString gviz = "digraph G { \n";
-	for (auto t : AllocatedGraphTasks) {
+	for (auto t : graph.tasks) {
 		t->BuildName();
 
 
@@ -145,15 +194,15 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 	
 
 
-	for (int i = 0; i < systasks.Num(); i++)
+	for (int i = 0; i < chains.Num(); i++)
 	{
-		SystemTaskChain* chain = systasks[i];
+		SystemTaskChain* chain = chains[i];
 		for (auto dep : chain->SystemDependencies)
 		{
 			//connect the first task of this to the last of dependencies
 
 			GraphTask* chaintask = nullptr;
-			for (auto t : AllocatedGraphTasks) {
+			for (auto t : graph.tasks) {
 				if (t && t->original == chain->firstTask)
 				{
 					chaintask = t; break;
@@ -162,12 +211,12 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 
 			GraphTask* deptask = nullptr;
 
-			for (int j = 0; j < systasks.Num(); j++) {
-				if (systasks[j]->name == dep) {
+			for (int j = 0; j < chains.Num(); j++) {
+				if (chains[j]->name == dep) {
 
-					SystemTaskChain* depchain = systasks[j];
+					SystemTaskChain* depchain = chains[j];
 
-					for (auto t : AllocatedGraphTasks) {
+					for (auto t : graph.tasks) {
 						if (t && t->original == depchain->lastTask)
 						{
 							deptask = t; break;
@@ -177,6 +226,11 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 					if (deptask) break;
 				}
 			}
+			//the dependency is in another phase or isnt registered
+			if (!deptask || !chaintask) {
+				continue;
+			}
+
 			bool bfound = false;
 							
 			for (auto succ : deptask->successors)
@@ -193,46 +247,127 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 			}
 		}
 	}
-	if (false)
-	{
-		std::ofstream f("E:/ECS_SpaceBattle/graphoutput.txt");
 
-		//f.open();
-		for (auto t : AllocatedGraphTasks) {
+	//parallel tasks get one chunk task per worker. Done after the graph is connected so the chunks never get picked as a chain task
+	const int32 numChunks = GetNumParallelChunks();
+	const int32 numGraphTasks = graph.tasks.Num();
+	for (int32 i = 0; i < numGraphTasks; i++) {
+		GraphTask* parent = graph.tasks[i];
+		if (!parent->original || !parent->original->IsParallel()) continue;
+
+		for (int32 c = 0; c < numChunks; c++) {
+			GraphTask* chunk = newTask(parent->original);
+			chunk->chunkParent = parent;
+			chunk->chunkIndex = c;
+			chunk->chainIndex = parent->chainIndex;
+			chunk->TaskName = parent->TaskName + "_chunk" + FString::FromInt(c);
+			parent->chunks.Add(chunk);
+		}
+	}
 
+}
 
-			FString strcolor = "[color = red,style = filled]; \n";
-			if (t->original) {
-				switch (t->original->type) {
-				case ESysTaskType::GameThread: strcolor = "[color = brown,style = filled];\n"; break;
-				case ESysTaskType::SyncPoint:strcolor = "[color = red,style = filled];\n"; break;
-				case ESysTaskType::FreeTask:strcolor = "[color = blue];\n"; break;
-				}
+void ECSSystemScheduler::WriteGraphviz(const FString& path) const
+{
+	FString gviz = "digraph G { \n";
+	for (auto t : AllocatedGraphTasks) {
+		if (t->chunkParent) continue;
+
+		FString strcolor = "[color = red,style = filled]; \n";
+		if (t->original) {
+			switch (t->original->type) {
+			case ESysTaskType::GameThread: strcolor = "[color = brown,style = filled];\n"; break;
+			case ESysTaskType::SyncPoint:strcolor = "[color = red,style = filled];\n"; break;
+			case ESysTaskType::FreeTask:strcolor = "[color = blue];\n"; break;
 			}
-			FString line = "\"" + t->TaskName + "\"" + strcolor;// [sides = 9, distortion = "0.936354", orientation = 28, skew = "-0.126818", color = salmon2];
+		}
+		FString line = "\"" + t->TaskName + "\"" + strcolor;// [sides = 9, distortion = "0.936354", orientation = 28, skew = "-0.126818", color = salmon2];
 
-			line += "\"" + t->TaskName + "\"" + " -> { ";
+		line += "\"" + t->TaskName + "\"" + " -> { ";
 
-			for (auto sc : t->successors) {
-				line += "\"" + sc->TaskName + "\"" + " ,";
-			}
-			line.RemoveFromEnd(",");
-			line += " }; \n";
+		for (auto sc : t->successors) {
+			line += "\"" + sc->TaskName + "\"" + " ,";
+		}
+		line.RemoveFromEnd(",");
+		line += " }; \n";
+
+		gviz += line;
+	}
+	gviz += "}";
+
+	FFileHelper::SaveStringToFile(gviz, *path);
+}
+
+void ECSSystemScheduler::SetTracing(bool bEnable, int32 framesPerFile)
+{
+	if (!bEnable) {
+		//flushes whatever is left into a last file
+		Trace.Reset();
+		return;
+	}
 
-			gviz += line;
+	if (!Trace) {
+		//one lane for the game thread and one per worker
+		const FString dir = FPaths::Combine(FPaths::ProfilingDir(), TEXT("ECSTrace"));
+		Trace = MakeUnique<ECSTaskTrace>(GetNumParallelChunks() + 1, framesPerFile, dir);
+
+		if (bCompiled) {
+			WriteGraphviz(FPaths::Combine(dir, TEXT("TaskGraph.dot")));
 		}
-		gviz += "}";
+	}
+	Trace->SetFramesPerFile(framesPerFile);
+}
+
+void ECSSystemScheduler::RunFrame(ECS_World* world, bool runParallel)
+{
+	ECS_Registry& reg = *world->GetRegistry();
+	ECSWorldClock& clock = world->Clock;
 
-		std::string ostr(TCHAR_TO_UTF8(GetData(gviz)));
-		f << ostr;
-		f.close();
+	if (Trace) {
+		Trace->BeginFrame();
+	}
+
+	//nothing is running yet, the temporary memory of the last frame can go
+	world->ScratchPad.Reset();
+
+	//the commands recorded in a step are applied before the next one, so every step sees the changes of the previous
+	for (int32 step = 0; step < clock.NumSubsteps; step++) {
+		clock.SubstepIndex = step;
+		clock.StepCount++;
+		Run(ESystemPhase::Simulation, runParallel, reg, world->ScratchPad);
+		world->Commands.Apply(reg);
+	}
+
+	Run(ESystemPhase::Frame, runParallel, reg, world->ScratchPad);
+	world->Commands.Apply(reg);
+
+	if (Trace) {
+		Trace->EndFrame();
+	}
+}
+
+void ECSSystemScheduler::Run(ESystemPhase phase, bool runParallel, ECS_Registry& reg, ECSFrameArena& arena)
+{
+	registry = &reg;
+
+	if (!bCompiled) {
+		Compile();
+	}
+
+	CompiledGraph& graph = graphs[(int32)phase];
+
+	//the graph is persistent, only the counters need to be rearmed
+	for (auto t : graph.tasks) {
+		t->predecessorCount = t->basePredecessorCount;
+		t->readyCycles = 0;
 	}
 	
 	if (!runParallel) {
 
-		TArray<GraphTask*> _pendingTasks;
+		//the task lists of every wave come from the frame arena
+		ECSFrameArray<GraphTask*> _pendingTasks(arena, graph.tasks.Num());
 
-		for (auto t : rootTask->successors) {
+		for (auto t : graph.rootTask->successors) {
 			
 			t->predecessorCount--;
 			if (t->predecessorCount == 0) {
@@ -243,10 +378,11 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 		while (_pendingTasks.Num() > 0)
 		{
 			for (auto t : _pendingTasks) {
-				t->original->function(reg);
+				ECSTraceScope traceScope(Trace.Get(), ECSTaskExecutor::GameThreadLane, t);
+				t->original->Execute(reg);
 			}
 
-			TArray<GraphTask*> newTasks;
+			ECSFrameArray<GraphTask*> newTasks(arena, _pendingTasks.Num());
 
 			for (auto t : _pendingTasks) {
 				for (auto nxt : t->successors) {
@@ -268,249 +404,23 @@ void ECSSystemScheduler::Run(bool runParallel, ECS_Registry& reg)
 	}
 	else {
 
-		endEvent = FPlatformProcess::GetSynchEventFromPool(false);
-
-
-		totalTasks = AllocatedGraphTasks.Num();
-
-		AsyncFinished(rootTask);
-
-		int loopcounts = 0;
-		bool breakloop = false;
-		while (totalTasks > 0  && !breakloop) {
-			SCOPE_CYCLE_COUNTER(STAT_TS_SyncLoop);
-
-			GraphTask* gametask;
-			while (gameTasks.Dequeue(gametask))
-			{
-			//	UE_LOG(LogFlying, Warning, TEXT("MTXLOCK:Gametask"));
-				
-				{
-					
-				
-
-					//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK:Gametask"));				
-
-					//UE_LOG(LogFlying, Warning, TEXT("Executing game task: %s"), *gametask->TaskName);
-
-					SCOPE_CYCLE_COUNTER(STAT_TS_GameTask);
-					gametask->original->function(reg);
-
-					AsyncFinished(gametask);
-				}				
-			}
-			//UE_LOG(LogFlying, Warning, TEXT("MTXLOCK: SyncLaunch0"));
-			endmutex.Lock();
-
-			if(pendingTasks.Num() == 0)
-			{
-				SCOPE_CYCLE_COUNTER(STAT_TS_SyncPoint);
-				GraphTask* sync = nullptr;
-
-				sync = syncTask;
-
-				while (sync) {
-
-					//UE_LOG(LogFlying, Warning, TEXT("Executing Root task: %s"), *sync->TaskName);
-
-					sync->original->function(reg);
-					syncTask = nullptr;
-					//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK: SyncLaunch"));
-					
-					AsyncFinished(sync);
-					//UE_LOG(LogFlying, Warning, TEXT("MTXLOCK: SyncLaunch"));
-					
-					sync = nullptr;
-					if (syncTask != nullptr)
-					{
-						sync = syncTask;
-						
-					}
-					else
-					{
-					//	UE_LOG(LogFlying, Warning, TEXT("MTXLOCK: SyncLaunch2"));
-					
-					}
-				};
-			}
-			
-			//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK: FinalSync"));
-			endmutex.Unlock();
-			endEvent->Wait(1);
-			loopcounts++;
-			if (loopcounts > 100) {
-				//UE_LOG(LogFlying, Warning, TEXT("Shits busted"));
-				breakloop = true;
-
-			}
+		if (!Executor) {
+			Executor = MakeUnique<ECSTaskExecutor>(GetNumParallelChunks());
 		}
-	}
-}
-
-void ECSSystemScheduler::AsyncFinished(GraphTask* task)
-{
-	SCOPE_CYCLE_COUNTER(STAT_TS_End1);
-
-	
-	//UE_LOG(LogFlying, Warning, TEXT("Task Finished: %s"), *task->TaskName);
-
-	//UE_LOG(LogFlying, Warning, TEXT("MTXLOCK:AsyncFinished0"));
-	endmutex.Lock();
-	
-	totalTasks--;
-	if (task->original)
-	{
-		RemovePending(task);
-	}
-	//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK:AsyncFinished0"));
-	endmutex.Unlock();
-
-	endEvent->Trigger();
 
-	//trigger execution of next task	
-	{
-		//UE_LOG(LogFlying, Warning, TEXT("MTXLOCK: AsyncFinished1"));
-		endmutex.Lock();
-		TArray<GraphTask*, TInlineAllocator<5>> executableTasks;
-		
-
-
-		for (auto nxt : task->successors) {
-
-			nxt->predecessorCount--;
-			if (nxt->predecessorCount == 0) {
-		
-				//UE_LOG(LogFlying, Warning, TEXT("ADD WAITING %s"), *nxt->TaskName);
-				waitingTasks.Add(nxt);			
-			}
-		}
-		
-		if (waitingTasks.Num() != 0) {
-
-			TArray<int, TInlineAllocator<5>> indicesToRemove;
-
-			for (int i = 0; i < waitingTasks.Num(); i++) {
-				if (CanExecute(waitingTasks[i])) {
-					GraphTask* tsk = waitingTasks[i];
-					//waitingTasks.RemoveAt(i);
-					executableTasks.Add(tsk);
-					indicesToRemove.Add(i);					
-					//i--;					
-				}
-			}
-			for (auto idx : indicesToRemove)
-			{
-				waitingTasks[idx] = nullptr;
-			}
+		Executor->Launch(graph.rootTask, graph.tasks.Num(), &reg, Trace.Get());
 
-			waitingTasks.Remove(nullptr);
-
-		}	
-		//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK: AsyncFinished1"));
-		endmutex.Unlock();
-
-		executableTasks.Sort([](const GraphTask& tA,const GraphTask& tB) {
-			return tA.priorityWeight > tB.priorityWeight;
-		});
-
-		for (auto t : executableTasks) {
-
-			//UE_LOG(LogFlying, Warning, TEXT("Launching task: %s"), *t->TaskName);
-			LaunchTask(t);
-		}
-	}
-}
-
-bool ECSSystemScheduler::LaunchTask(GraphTask* task)
-{
-	SCOPE_CYCLE_COUNTER(STAT_TS_End2);
-
-	//UE_LOG(LogFlying, Warning, TEXT("MTXLOCK:LaunchTask"));
-	endmutex.Lock();
-	ESysTaskType tasktype = task->original->type;
-	if (tasktype == ESysTaskType::SyncPoint) {
-		syncTask = task;
-		endmutex.Unlock(); 
-		
-		return true;
-	}
-	else 
 		{
-			if (!CanExecute(task))
-			{
-				waitingTasks.Add(task);
-				//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK: LaunchTask"));
-				endmutex.Unlock();
-				return false;
-			}
-			else {
-
-				EAsyncExecution exec;
-				if (tasktype == ESysTaskType::FreeTask)
-				{
-					exec = EAsyncExecution::TaskGraph;
-
-					TFuture<void> fut = Async(exec, [=]() {
-						SCOPE_CYCLE_COUNTER(STAT_TS_AsyncTask);
-						task->original->function(*registry);
-						AsyncFinished(task);
-						},
-
-						[=]() {
-
-						}
-						);
-
-					AddPending(task, &fut);
-					//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK:LaunchTask1"));
-					endmutex.Unlock();
-				}
-				else {
-					//UE_LOG(LogFlying, Warning, TEXT("MTXUNLOCK:LaunchTask1"));
-					AddPending(task, nullptr);
-					endmutex.Unlock();
-					gameTasks.Enqueue(task);
-				}
-
-				
-				return true;
-			}
-		}
-	return false;
-}
-void ECSSystemScheduler::RemovePending(GraphTask* task)
-{
-	//remove from pending tasks
-	for (int i = 0; i < pendingTasks.Num(); i++) {
-		if (pendingTasks[i]->task == task) {
-			pendingTasks.RemoveAt(i);
-			break;
+			SCOPE_CYCLE_COUNTER(STAT_TS_SyncLoop);
+			//the game thread works through the graph with the workers until every task is done
+			Executor->RunGameThread();
 		}
 	}
 }
-void ECSSystemScheduler::AddPending(GraphTask* task, TFuture<void>* future)
-{
-	TSharedPtr<LaunchedTask> newTask = MakeShared<LaunchedTask>();
-
-	newTask->task = task;
-	if (future) {
-		newTask->future = std::move(*future);
-	}
-
-	//UE_LOG(LogFlying, Warning, TEXT("ADD PENDING %s"),*task->TaskName);
-	newTask->dependencies = task->original->deps;
-
-	pendingTasks.Add(newTask);
-}
 
-bool ECSSystemScheduler::CanExecute(GraphTask* task)
+int32 ECSSystemScheduler::GetNumParallelChunks() const
 {
-	for (auto& t : pendingTasks) {
-		if (t->dependencies.ConflictsWith(task->original->deps)) {
-			return false;
-		}
-	}
-	return true;
+	return FMath::Max(FPlatformMisc::NumberOfWorkerThreadsToSpawn(), 1);
 }
 
 SystemTask* ECSSystemScheduler::NewTask()
@@ -526,6 +436,8 @@ GraphTask* ECSSystemScheduler::NewGraphTask(SystemTask* originalTask)
 {
 	GraphTask* taks = new GraphTask();
 	taks->original = originalTask;
+	taks->taskIndex = AllocatedGraphTasks.Num();
+	taks->basePredecessorCount = 0;
 	taks->predecessorCount = 0;
 	taks->priorityWeight = 1;
 	if (originalTask && originalTask->ownerGraph)
@@ -548,11 +460,18 @@ SystemTaskChain* ECSSystemScheduler::NewTaskChain()
 }
 ECSSystemScheduler::~ECSSystemScheduler() {
 	
+	Executor.Reset();
+	Trace.Reset();
 	Reset();
 }
 
 void ECSSystemScheduler::Reset()
 {
+	//the recorded spans point to the tasks that are about to be deleted
+	if (Trace) {
+		Trace->Flush();
+	}
+
 	for (auto t : AllocatedTasks)
 	{
 		delete t;
@@ -569,8 +488,12 @@ void ECSSystemScheduler::Reset()
 	AllocatedTasks.Reset();
 	AllocatedGraphTasks.Reset();
 	AllocatedChains.Reset();
+	for (auto& graph : graphs) {
+		graph.rootTask = nullptr;
+		graph.tasks.Reset();
+	}
+	bCompiled = false;
+	compiledSystemsVersion = -1;
 	systasks.Reset();
-	waitingTasks.Reset();
-	pendingTasks.Reset();
 }
 
@@ -1,86 +1,107 @@
 #pragma once
 #include <ECS_Core.h>
+#include <atomic>
 
 
-struct TypeHash {
-	size_t name_hash{ 0 };
-	size_t matcher_hash{ 0 };
+//Dense integer ids for component types. A type gets its id the first time it shows up in a dependency,
+//so the ids are small and can index a bitset. Works the same on every compiler.
+struct ComponentTypeId {
+	static constexpr int32 MaxComponents = 128;
 
-	bool operator==(const TypeHash& other)const {
-		return name_hash == other.name_hash;
-	}
 	template<typename T>
-	static constexpr const char* name_detail() {
-		return __FUNCSIG__;
+	static int32 Get() {
+		static_assert(!std::is_reference<T>::value, "dont send references to the type id");
+		static_assert(!std::is_const<T>::value, "dont send const to the type id");
+
+		static const int32 id = Next();
+		return id;
 	}
 
-	static inline constexpr uint64_t hash_fnv1a(const char* key) {
-		uint64_t hash = 0xcbf29ce484222325;
-		uint64_t prime = 0x100000001b3;
+private:
+	static int32 Next();
+};
 
-		int i = 0;
-		while (key[i]) {
-			uint8_t value = key[i++];
-			hash = hash ^ value;
-			hash *= prime;
-		}
+//fixed width set of component ids
+struct ComponentMask {
+	static constexpr int32 NumWords = ComponentTypeId::MaxComponents / 64;
+
+	uint64 words[NumWords] = {};
 
-		return hash;
+	void Set(int32 id) {
+		words[id >> 6] |= uint64(1) << (id & 63);
 	}
 
-	template<typename T>
-	static constexpr size_t hash() {
+	bool Has(int32 id) const {
+		return (words[id >> 6] & (uint64(1) << (id & 63))) != 0;
+	}
 
-		static_assert(!std::is_reference_v<T>, "dont send references to hash");
-		static_assert(!std::is_const_v<T>, "dont send const to hash");
-		return hash_fnv1a(name_detail<T>());
+	bool Intersects(const ComponentMask& other) const {
+		uint64 result = 0;
+		for (int32 i = 0; i < NumWords; i++) {
+			result |= words[i] & other.words[i];
+		}
+		return result != 0;
 	}
-};
 
+	ComponentMask operator|(const ComponentMask& other) const {
+		ComponentMask result;
+		for (int32 i = 0; i < NumWords; i++) {
+			result.words[i] = words[i] | other.words[i];
+		}
+		return result;
+	}
+};
 
 struct TaskDependencies {
 
 
 	template<typename T>
 	void AddRead() {
-		readHashes.Add(TypeHash::hash<T>());
+		reads.Set(ComponentTypeId::Get<T>());
 	}
 
 	template<typename T>
 	void AddWrite()
 	{
-		writeHashes.Add(TypeHash::hash<T>());
+		writes.Set(ComponentTypeId::Get<T>());
+	}
+
+	//adds the columns of a query signature. const T is a read, T and optional T* are writes
+	template<typename... Q>
+	void AddQuery(const flecs::query<Q...>& query) {
+		int dummy[] = { 0, (AddQueryColumn<Q>(), 0)... };
+		(void)dummy;
+	}
+
+	template<typename... Queries>
+	static TaskDependencies FromQueries(const Queries&... queries) {
+		TaskDependencies deps;
+		int dummy[] = { 0, (deps.AddQuery(queries), 0)... };
+		(void)dummy;
+		return deps;
 	}
 
-	TArray<size_t, TInlineAllocator<5>> readHashes;
-	TArray<size_t, TInlineAllocator<5>> writeHashes;
+	ComponentMask reads;
+	ComponentMask writes;
 
 	bool ConflictsWith(const TaskDependencies& other) const{
-		//very dumb algo version
-		
-		for (auto s : writeHashes) {
-			for (auto r :other.readHashes) {
-				if (s == r) {
-					return true;
-				}
-			}
-			for (auto r : other.writeHashes) {
-				if (s == r) {
-					return true;
-				}
-			}
-		}
+		//a write conflicts with anything touching the same component, two reads never conflict
+		return writes.Intersects(other.reads | other.writes) || reads.Intersects(other.writes);
+	}
 
-		for (auto s : readHashes) {
-			for (auto r : other.writeHashes) {
-				if (s == r) {
-					return true;
-				}
-			}
+private:
+	template<typename Q>
+	void AddQueryColumn() {
+		using Column = typename std::remove_pointer<Q>::type;
+		using Component = typename std::remove_const<Column>::type;
+
+		if (std::is_const<Column>::value) {
+			AddRead<Component>();
+		}
+		else {
+			AddWrite<Component>();
 		}
-		return false;
 	}
-
 };
 enum class ESysTaskType : uint8_t {
 	GameThread,
@@ -88,6 +109,14 @@ enum class ESysTaskType : uint8_t {
 	FreeTask
 };
 
+//a frame runs the simulation phase once per fixed step of the world clock, then the frame phase once
+enum class ESystemPhase : uint8_t {
+	Simulation,
+	Frame,
+
+	Count
+};
+
 enum class ESysTaskFlags : uint32_t {
 	ExecuteAsync = 1 << 0,
 	ExecuteGameThread = 1 << 1,
@@ -104,6 +133,21 @@ struct SystemTask {
 	
 	class SystemTaskChain* ownerGraph{nullptr};
 	TFunction<void(ECS_Registry&)> function;
+
+	//parallel tasks run function once and then chunkFunction once per chunk, spread over the workers
+	TFunction<void(ECS_Registry&, int32 chunk, int32 numChunks)> chunkFunction;
+
+	bool IsParallel() const {
+		return (bool)chunkFunction;
+	}
+
+	//runs the whole task on the calling thread, a parallel task runs as a single chunk
+	void Execute(ECS_Registry& reg) {
+		function(reg);
+		if (IsParallel()) {
+			chunkFunction(reg, 0, 1);
+		}
+	}
 };
 
 struct GraphTask {
@@ -111,11 +155,26 @@ struct GraphTask {
 	FString TaskName;
 	int chainIndex = 0;
 	float priorityWeight = 0;
-	int predecessorCount = 1;
+	//index in the scheduler allocation list, used as a tie breaker between conflicting tasks
+	int taskIndex = 0;
+	//predecessor count as built by the compiled graph, copied into predecessorCount at the start of every run
+	int basePredecessorCount = 0;
+	std::atomic<int> predecessorCount{ 1 };
 	TArray<GraphTask*, TInlineAllocator<2>> successors;
 
+	//chunk tasks of a parallel task. They arent connected to the graph, the executor pushes them when the parent starts
+	TArray<GraphTask*> chunks;
+	GraphTask* chunkParent{ nullptr };
+	int32 chunkIndex = 0;
+	std::atomic<int32> chunksRemaining{ 0 };
+	//running slot the parent holds until its last chunk finishes
+	int32 runningSlot = INDEX_NONE;
+
+	//when the task became ready to run, only tracked while a trace is recording
+	uint64 readyCycles = 0;
+
 	void AddSuccesor(GraphTask* succesor) {
-		succesor->predecessorCount++;
+		succesor->basePredecessorCount++;
 		successors.Add(succesor);
 	}
 	void BuildName();
@@ -129,6 +188,7 @@ public:
 	int sortKey;
 	FString name;
 	float priority = 1.f;
+	ESystemPhase phase{ ESystemPhase::Simulation };
 	TArray<FString, TInlineAllocator<2>> SystemDependencies;
 
 	bool HasSyncPoint() {
@@ -147,7 +207,7 @@ public:
 		SystemTask* task = firstTask;
 		while (task)
 		{
-			task->function(reg);
+			task->Execute(reg);
 			task = task->next;
 		}
 	};
@@ -169,50 +229,64 @@ public:
 
 class ECSSystemScheduler {
 
-	struct LaunchedTask {
-		GraphTask* task;
-		//SystemTask* task;
-		TaskDependencies dependencies;
-		TFuture<void> future;
-	};
-
 public:
 
 	~ECSSystemScheduler();
 	
 	TArray<SystemTaskChain*> systasks;
 	ECS_Registry* registry;
+
+	//the ForEach and ForIter tasks that write any of the transform components mark the tables they go through here
+	ECSTransformVersions* transformVersions{ nullptr };
+	ComponentMask transformWrites;
 	
 	void AddTaskgraph(SystemTaskChain* newGraph);
-	
-	void Run(bool runParallel, ECS_Registry& reg);
 
-	void Reset();
+	//true if the compiled graph is missing or was built from a different set of systems
+	bool NeedsRebuild(const ECS_World* world) const;
 
-	void AsyncFinished(GraphTask* task);
+	//schedules every system of the world and compiles the result into the persistent graph
+	void Rebuild(ECS_World* world);
 
-	bool LaunchTask(GraphTask* task);
+	//builds the graph tasks from the scheduled chains. Only needs to be done when systems change
+	void Compile();
+
+	struct CompiledGraph {
+		//root of the graph, it does nothing and releases the first task of every chain
+		GraphTask* rootTask{ nullptr };
+		//every graph task of the phase, chunks included
+		TArray<GraphTask*> tasks;
+	};
 
-	void AddPending(GraphTask* task, TFuture<void>* future);
-	void RemovePending(GraphTask* task);
+	//builds the graph of one phase. Dependencies on chains outside of it are skipped
+	void CompilePhase(TArray<SystemTaskChain*>& chains, CompiledGraph& graph);
 
-	bool CanExecute(GraphTask* task);
+	//how many chunks a parallel task gets split into, one per worker
+	int32 GetNumParallelChunks() const;
 
-	TArray<GraphTask*> waitingTasks;
-	TArray<TSharedPtr<LaunchedTask>> pendingTasks;
+	//starts or stops recording a trace of every task execution, see ECSTaskTrace
+	void SetTracing(bool bEnable, int32 framesPerFile);
 
-	TQueue<GraphTask*> gameTasks;
-	GraphTask* syncTask;
+	void WriteGraphviz(const FString& path) const;
+	
+	//runs the simulation graph once per substep of the world clock, and then the frame graph.
+	//The world command buffers are applied after every graph
+	void RunFrame(ECS_World* world, bool runParallel);
 
+	//runs the graph of a single phase to completion. The arena is for the temporary lists of the serial path
+	void Run(ESystemPhase phase, bool runParallel, ECS_Registry& reg, ECSFrameArena& arena);
 
-	FCriticalSection mutex;
+	void Reset();
 
-	FCriticalSection endmutex;
+	//worker threads for the parallel path, created on the first parallel run
+	TUniquePtr<class ECSTaskExecutor> Executor;
 
-	TAtomic<int> totalTasks;
-	//TAtomic<int> tasksUntilSync;
-	FEvent* endEvent;
+	//null unless tracing is enabled
+	TUniquePtr<class ECSTaskTrace> Trace;
 
+	CompiledGraph graphs[(int32)ESystemPhase::Count];
+	bool bCompiled{ false };
+	int compiledSystemsVersion{ -1 };
 
 	SystemTask* NewTask();
 	GraphTask* NewGraphTask(SystemTask* originalTask);
@@ -226,6 +300,84 @@ public:
 	TArray<SystemTaskChain*> AllocatedChains;
 };
 
+//Splits the rows matched by a query into contiguous ranges, so the same query can be iterated from several threads at once.
+//A chunk can start and end in the middle of a table, so the chunks stay balanced no matter how the rows are spread between tables.
+struct QueryChunks {
+
+	//ecs_query_iter sorts the query and resets its dirty state, so this has to run once on a single thread before the chunks
+	void Start(ecs_query_t* query) {
+		baseIter = ecs_query_iter(query);
+		totalRows = 0;
+
+		ecs_iter_t it = baseIter;
+		while (ecs_query_next(&it)) {
+			totalRows += it.count;
+		}
+	}
+
+	//first row of the chunk, counting from the start of the query
+	int32 ChunkBegin(int32 chunk, int32 numChunks) const {
+		return int32(int64(totalRows) * chunk / numChunks);
+	}
+
+	//calls Body with an iterator narrowed to the rows of the chunk, once for every table the chunk touches
+	template<typename Func>
+	void ForEachInChunk(int32 chunk, int32 numChunks, Func&& Body) const {
+		const int32 begin = ChunkBegin(chunk, numChunks);
+		const int32 end = ChunkBegin(chunk + 1, numChunks);
+
+		ecs_iter_t it = baseIter;
+		int32 tableStart = 0;
+		while (tableStart < end && ecs_query_next(&it)) {
+			const int32 tableEnd = tableStart + it.count;
+			const int32 first = FMath::Max(begin, tableStart) - tableStart;
+			const int32 last = FMath::Min(end, tableEnd) - tableStart;
+			tableStart = tableEnd;
+
+			if (first < last) {
+				ecs_iter_t chunkIt = it;
+				chunkIt.offset += first;
+				chunkIt.entities += first;
+				chunkIt.count = last - first;
+				Body(&chunkIt);
+			}
+		}
+	}
+
+	ecs_iter_t baseIter{};
+	int32 totalRows = 0;
+};
+
+//Table column of a component the query doesnt ask for, starting at the first row of the iterator so it lines up with the query columns.
+//flecs::iter::table_column starts at the first row of the table, which is wrong for the chunks of QueryChunks that start in the middle of one.
+//Null if the table doesnt have the component
+template<typename T>
+T* ECSTableColumn(const ecs_iter_t* it) {
+	using Component = typename std::remove_const<T>::type;
+	const int32 index = ecs_type_index_of(ecs_iter_type(it), flecs::_::component_info<Component>::id(it->world));
+	return index != -1 ? static_cast<T*>(ecs_table_column(it, index)) + it->offset : nullptr;
+}
+
+//same for the iterator of a query.iter callback. flecs::iter doesnt expose its first row, so it comes from where the first query column
+//points into its table column. The first query column has to be a component the table owns
+template<typename T>
+T* ECSTableColumn(const flecs::iter& it) {
+	using Component = typename std::remove_const<T>::type;
+	const ecs_type_t type = it.table_type().c_ptr();
+	const int32 index = ecs_type_index_of(type, flecs::_::component_info<Component>::id(it.world().c_ptr()));
+	if (index == -1 || it.count() == 0) {
+		return nullptr;
+	}
+
+	const int32 firstIndex = ecs_type_index_of(type, it.column_entity(1).id());
+	check(firstIndex != -1);
+	const uint8* firstRow = static_cast<const uint8*>(it.column(1)[0]);
+	const uint8* firstTableRow = static_cast<const uint8*>(it.table_column(firstIndex));
+	const int32 offset = int32((firstRow - firstTableRow) / it.column_size(1));
+
+	return static_cast<T*>(it.table_column(index)) + offset;
+}
+
 class SystemTaskBuilder {
 public:
 	SystemTaskBuilder(FString name, int sortkey, class ECSSystemScheduler* _scheduler, float Priority = 1.f) {
@@ -255,6 +407,14 @@ public:
 		//graph->functions.Add(std::move(c)); 
 	};
 
+	//same as AddTask, but the dependencies are deduced from the signature of the query the task iterates
+	template<typename C, typename... Q>
+	void AddTask(const flecs::query<Q...>& query, C&& c, ESysTaskFlags flags = ESysTaskFlags::ExecuteAsync) {
+		TaskDependencies deps;
+		deps.AddQuery(query);
+		AddTask(deps, std::forward<C>(c), flags);
+	};
+
 	template< typename C>
 	void AddGameTask(const TaskDependencies& deps, C&& c, ESysTaskFlags flags = ESysTaskFlags::ExecuteGameThread) {
 		SystemTask* task = scheduler->NewTask();
@@ -272,11 +432,89 @@ public:
 		graph->AddTask(task);
 	};
 
+	template<typename C, typename... Q>
+	void AddGameTask(const flecs::query<Q...>& query, C&& c, ESysTaskFlags flags = ESysTaskFlags::ExecuteGameThread) {
+		TaskDependencies deps;
+		deps.AddQuery(query);
+		AddGameTask(deps, std::forward<C>(c), flags);
+	};
+
+	//prepare runs once, then chunk runs once per chunk across the workers. The successors wait for every chunk
+	template<typename P, typename C>
+	void AddParallelTask(const TaskDependencies& deps, P&& prepare, C&& chunk, ESysTaskFlags flags = ESysTaskFlags::ExecuteAsync) {
+		AddTask(deps, std::forward<P>(prepare), flags);
+		graph->lastTask->chunkFunction = std::move(chunk);
+	};
+
+	//splits the rows of the query between the workers. The kernel has the signature of a query.each callback.
+	//the query has to be initialized before this is called. If the deps write a transform component, every table slice gets marked as changed
+	template<typename Func, typename... Q>
+	void AddParallelForEach(const flecs::query<Q...>& query, const TaskDependencies& deps, Func&& kernel) {
+		using Kernel = typename std::decay<Func>::type;
+
+		check(query.c_ptr());
+		ecs_query_t* q = query.c_ptr();
+		TSharedRef<QueryChunks, ESPMode::ThreadSafe> split = MakeShared<QueryChunks, ESPMode::ThreadSafe>();
+		Kernel k = std::forward<Func>(kernel);
+		ECSTransformVersions* versions = TransformVersionsFor(deps);
+
+		AddParallelTask(deps,
+			[split, q](ECS_Registry& reg) {
+				split->Start(q);
+			},
+			[split, k, versions](ECS_Registry& reg, int32 chunk, int32 numChunks) {
+				split->ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* it) {
+					flecs::_::column_args<Q...> columns(it);
+					flecs::_::each_invoker<Kernel, Q...>::call_system(it, k, 0, columns.m_columns);
+					if (versions) {
+						versions->MarkTable(ecs_iter_type(it));
+					}
+				});
+			});
+	};
+
+	//same as AddParallelForEach, but the kernel has the signature of a query.iter callback and gets called once per table slice
+	template<typename Func, typename... Q>
+	void AddParallelForIter(const flecs::query<Q...>& query, const TaskDependencies& deps, Func&& kernel) {
+		using Kernel = typename std::decay<Func>::type;
+
+		check(query.c_ptr());
+		ecs_query_t* q = query.c_ptr();
+		TSharedRef<QueryChunks, ESPMode::ThreadSafe> split = MakeShared<QueryChunks, ESPMode::ThreadSafe>();
+		Kernel k = std::forward<Func>(kernel);
+		ECSTransformVersions* versions = TransformVersionsFor(deps);
+
+		AddParallelTask(deps,
+			[split, q](ECS_Registry& reg) {
+				split->Start(q);
+			},
+			[split, k, versions](ECS_Registry& reg, int32 chunk, int32 numChunks) {
+				split->ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* it) {
+					flecs::_::column_args<Q...> columns(it);
+					flecs::_::iter_invoker<Kernel, Q...>::call_system(it, k, 0, columns.m_columns);
+					if (versions) {
+						versions->MarkTable(ecs_iter_type(it));
+					}
+				});
+			});
+	};
+
+	//null when the task doesnt write a transform component
+	ECSTransformVersions* TransformVersionsFor(const TaskDependencies& deps) const {
+		return deps.writes.Intersects(scheduler->transformWrites) ? scheduler->transformVersions : nullptr;
+	}
+
 	void AddDependency(FString dependency) {
 		graph->SystemDependencies.Add(dependency);
 	}
 
+	//chains run in the simulation phase unless told otherwise
+	void SetPhase(ESystemPhase phase) {
+		graph->phase = phase;
+	}
+
 
+	//locks the whole registry. Structural changes dont need this, they can be recorded into the world command buffers
 	template<typename C>
 	void AddSyncTask(C&& c) {
 		SystemTask* task = scheduler->NewTask();//new SystemTask();		
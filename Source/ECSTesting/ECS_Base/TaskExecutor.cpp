@@ -0,0 +1,466 @@
+#include "TaskExecutor.h"
+#include "SystemTasks.h"
+#include "TaskTrace.h"
+
+DECLARE_CYCLE_STAT(TEXT("TaskSys: GameTask"), STAT_TE_GameTask, STATGROUP_ECS);
+DECLARE_CYCLE_STAT(TEXT("TaskSys: AsyncTask"), STAT_TE_AsyncTask, STATGROUP_ECS);
+DECLARE_CYCLE_STAT(TEXT("TaskSys: ChunkTask"), STAT_TE_ChunkTask, STATGROUP_ECS);
+DECLARE_CYCLE_STAT(TEXT("TaskSys: TaskEnd"), STAT_TE_TaskEnd, STATGROUP_ECS);
+DECLARE_CYCLE_STAT(TEXT("TaskSys: GameThread Wait"), STAT_TE_GameWait, STATGROUP_ECS);
+
+//how many times an idle worker looks for work before going to sleep
+static constexpr int32 WorkerSpinCount = 64;
+//the game thread spins longer, the frame is waiting on it
+static constexpr int32 GameThreadSpinCount = 256;
+
+ECSWorkDeque::ECSWorkDeque()
+{
+	top.store(0);
+	bottom.store(0);
+	for (auto& b : buffer) {
+		b.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+void ECSWorkDeque::Push(GraphTask* task)
+{
+	const int64 b = bottom.load(std::memory_order_relaxed);
+	const int64 t = top.load(std::memory_order_acquire);
+	check(b - t < Capacity);
+
+	buffer[b & (Capacity - 1)].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+GraphTask* ECSWorkDeque::Pop()
+{
+	const int64 b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64 t = top.load(std::memory_order_relaxed);
+
+	GraphTask* task = nullptr;
+	if (t <= b) {
+		task = buffer[b & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (t == b) {
+			//last item, race against the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				task = nullptr;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+	}
+	else {
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return task;
+}
+
+GraphTask* ECSWorkDeque::Steal()
+{
+	int64 t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64 b = bottom.load(std::memory_order_acquire);
+
+	if (t < b) {
+		GraphTask* task = buffer[t & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		return task;
+	}
+	return nullptr;
+}
+
+ECSTaskExecutor::ECSTaskExecutor(int32 NumWorkers)
+{
+	NumWorkers = FMath::Max(NumWorkers, 1);
+
+	workEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	gameEvent = FPlatformProcess::GetSynchEventFromPool(false);
+
+	//one deque per worker plus the game thread
+	for (int32 i = 0; i < NumWorkers + 1; i++) {
+		deques.Add(new ECSWorkDeque());
+	}
+
+	//a parallel task keeps its slot until its last chunk is done, so a thread can have started more than one of them.
+	//if the slots still run out the task parks until one is released
+	numSlots = NumWorkers * 2 + 2;
+	slots = new RunningSlot[numSlots];
+
+	for (int32 i = 0; i < NumWorkers; i++) {
+		Worker w;
+		w.runnable = new WorkerRunnable(this, i + 1);
+		w.thread = FRunnableThread::Create(w.runnable, *FString::Printf(TEXT("ECSWorker%d"), i), 0, TPri_Normal);
+		Workers.Add(w);
+	}
+}
+
+ECSTaskExecutor::~ECSTaskExecutor()
+{
+	bStopping = true;
+	for (int32 i = 0; i < Workers.Num(); i++) {
+		workEvent->Trigger();
+	}
+	for (auto& w : Workers) {
+		w.thread->WaitForCompletion();
+		delete w.thread;
+		delete w.runnable;
+	}
+	Workers.Reset();
+
+	for (auto d : deques) {
+		delete d;
+	}
+	delete[] slots;
+
+	FPlatformProcess::ReturnSynchEventToPool(workEvent);
+	FPlatformProcess::ReturnSynchEventToPool(gameEvent);
+}
+
+void ECSTaskExecutor::Launch(GraphTask* root, int32 numTasks, ECS_Registry* reg, ECSTaskTrace* _trace)
+{
+	registry = reg;
+	trace = _trace;
+	remainingTasks = numTasks;
+
+	//the root has no work, finishing it releases the first task of every chain
+	FinishTask(root, GameThreadLane, false);
+}
+
+bool ECSTaskExecutor::RunGameTask()
+{
+	GraphTask* task;
+	if (!gameTasks.Dequeue(task)) {
+		return false;
+	}
+
+	const int32 slot = AcquireSlot(task, GameThreadLane);
+	if (slot == INDEX_NONE) {
+		return true;
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TE_GameTask);
+		ECSTraceScope traceScope(trace, GameThreadLane, task);
+		task->original->function(*registry);
+	}
+
+	ReleaseSlot(slot, GameThreadLane);
+	FinishTask(task, GameThreadLane, false);
+	return true;
+}
+
+void ECSTaskExecutor::RunGameThread()
+{
+	int32 idleLoops = 0;
+	while (!IsFinished()) {
+
+		if (RunGameTask()) {
+			idleLoops = 0;
+			continue;
+		}
+
+		if (GraphTask* task = FindWork(GameThreadLane)) {
+			idleLoops = 0;
+			if (HasWork()) {
+				WakeWorker();
+			}
+			Execute(task, GameThreadLane);
+			continue;
+		}
+
+		if (++idleLoops < GameThreadSpinCount) {
+			FPlatformProcess::SleepNoStats(0.f);
+			continue;
+		}
+
+		//the event is auto reset, a trigger that lands between the check and the wait is kept for the wait.
+		//Free tasks dont wake the game thread, the workers take those. A parked game task is dispatched again when its slot is released, which triggers the event
+		SCOPE_CYCLE_COUNTER(STAT_TE_GameWait);
+		if (gameTasks.IsEmpty() && !HasWork() && !IsFinished()) {
+			gameEvent->Wait();
+		}
+		idleLoops = 0;
+	}
+}
+
+void ECSTaskExecutor::WorkerLoop(int32 lane)
+{
+	int32 idleLoops = 0;
+	while (!bStopping) {
+
+		GraphTask* task = FindWork(lane);
+		if (task) {
+			idleLoops = 0;
+			//more work than this thread can take, get another worker going
+			if (HasWork()) {
+				WakeWorker();
+			}
+			Execute(task, lane);
+			continue;
+		}
+
+		if (++idleLoops < WorkerSpinCount) {
+			FPlatformProcess::SleepNoStats(0.f);
+			continue;
+		}
+
+		//announce the sleep before checking again, so a push that happens in between always triggers the event
+		sleepingWorkers++;
+		if (!HasWork() && !bStopping) {
+			workEvent->Wait(10);
+		}
+		sleepingWorkers--;
+		idleLoops = 0;
+	}
+}
+
+bool ECSTaskExecutor::Conflicts(const GraphTask* task, const GraphTask* other) const
+{
+	if (task->original->type == ESysTaskType::SyncPoint || other->original->type == ESysTaskType::SyncPoint) {
+		return true;
+	}
+	return task->original->deps.ConflictsWith(other->original->deps);
+}
+
+int32 ECSTaskExecutor::AcquireSlot(GraphTask* task, int32 lane)
+{
+	int32 mySlot = INDEX_NONE;
+	GraphTask* owner = nullptr;
+	for (int32 i = 0; i < numSlots; i++) {
+		owner = slots[i].task.load();
+		if (owner == nullptr && slots[i].task.compare_exchange_strong(owner, task)) {
+			mySlot = i;
+			break;
+		}
+	}
+	if (mySlot == INDEX_NONE) {
+		//every slot is taken, wait for the last one
+		Park(task, numSlots - 1, owner, lane);
+		return INDEX_NONE;
+	}
+
+	//the slot is published but not committed. Two tasks probing at the same time can see each other,
+	//the one with the lower index wins and the other backs off
+	for (int32 i = 0; i < numSlots; i++) {
+		if (i == mySlot) continue;
+
+		while (true) {
+			GraphTask* other = slots[i].task.load();
+			if (!other || !Conflicts(task, other)) {
+				break;
+			}
+			if (slots[i].committed.load() || other->taskIndex < task->taskIndex) {
+				ReleaseSlot(mySlot, lane);
+				Park(task, i, other, lane);
+				return INDEX_NONE;
+			}
+			//the other task will back off or commit, wait to see which
+			while (slots[i].task.load() == other && !slots[i].committed.load()) {
+				FPlatformProcess::SleepNoStats(0.f);
+			}
+		}
+	}
+
+	slots[mySlot].committed.store(true);
+	return mySlot;
+}
+
+void ECSTaskExecutor::ReleaseSlot(int32 slot, int32 lane)
+{
+	//committed has to be cleared first, a free slot must never look committed to the next owner
+	slots[slot].committed.store(false);
+	slots[slot].task.store(nullptr);
+
+	WakeWaiters(slot, lane);
+}
+
+void ECSTaskExecutor::Execute(GraphTask* task, int32 lane)
+{
+	GraphTask* current = task;
+	while (current) {
+		//chunks run under the slot of their parent
+		if (current->chunkParent) {
+			current = RunChunk(current, lane);
+			continue;
+		}
+
+		const int32 slot = AcquireSlot(current, lane);
+		if (slot == INDEX_NONE) {
+			return;
+		}
+
+		if (current->chunks.Num() > 0) {
+			current = StartChunks(current, slot, lane);
+			continue;
+		}
+
+		{
+			SCOPE_CYCLE_COUNTER(STAT_TE_AsyncTask);
+			ECSTraceScope traceScope(trace, lane, current);
+			current->original->function(*registry);
+		}
+
+		ReleaseSlot(slot, lane);
+		//the game thread doesnt chain into continuations, it goes back to check for game tasks first
+		current = FinishTask(current, lane, lane != GameThreadLane);
+	}
+}
+
+GraphTask* ECSTaskExecutor::StartChunks(GraphTask* task, int32 slot, int32 lane)
+{
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TE_AsyncTask);
+		ECSTraceScope traceScope(trace, lane, task);
+		task->original->function(*registry);
+	}
+
+	task->runningSlot = slot;
+	task->chunksRemaining = task->chunks.Num();
+
+	const uint64 readyCycles = trace ? FPlatformTime::Cycles64() : 0;
+	//the other workers steal from the top, this thread takes the first chunk itself
+	for (int32 i = task->chunks.Num() - 1; i >= 0; i--) {
+		task->chunks[i]->readyCycles = readyCycles;
+		if (i > 0) {
+			deques[lane]->Push(task->chunks[i]);
+		}
+	}
+	WakeWorker();
+
+	return task->chunks[0];
+}
+
+GraphTask* ECSTaskExecutor::RunChunk(GraphTask* chunk, int32 lane)
+{
+	GraphTask* parent = chunk->chunkParent;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TE_ChunkTask);
+		ECSTraceScope traceScope(trace, lane, chunk);
+		parent->original->chunkFunction(*registry, chunk->chunkIndex, parent->chunks.Num());
+	}
+
+	GraphTask* continuation = nullptr;
+	//the last chunk releases the slot of the parent and finishes it, which is what lets the successors go
+	if (--parent->chunksRemaining == 0) {
+		ReleaseSlot(parent->runningSlot, lane);
+		continuation = FinishTask(parent, lane, lane != GameThreadLane);
+	}
+
+	CompleteTask();
+	return continuation;
+}
+
+GraphTask* ECSTaskExecutor::FinishTask(GraphTask* task, int32 lane, bool bAllowContinuation)
+{
+	SCOPE_CYCLE_COUNTER(STAT_TE_TaskEnd);
+
+	const uint64 readyCycles = trace ? FPlatformTime::Cycles64() : 0;
+
+	TArray<GraphTask*, TInlineAllocator<8>> readyTasks;
+	for (auto nxt : task->successors) {
+		if (--nxt->predecessorCount == 0) {
+			nxt->readyCycles = readyCycles;
+			readyTasks.Add(nxt);
+		}
+	}
+
+	readyTasks.Sort([](const GraphTask& tA, const GraphTask& tB) {
+		return tA.priorityWeight > tB.priorityWeight;
+	});
+
+	GraphTask* continuation = nullptr;
+	//pushed from lowest to highest priority so the owner pops the best one first
+	for (int32 i = readyTasks.Num() - 1; i >= 0; i--) {
+		GraphTask* t = readyTasks[i];
+		if (bAllowContinuation && !continuation && i == 0 && t->original->type == ESysTaskType::FreeTask) {
+			continuation = t;
+		}
+		else {
+			Dispatch(t, lane);
+		}
+	}
+
+	CompleteTask();
+	return continuation;
+}
+
+void ECSTaskExecutor::CompleteTask()
+{
+	if (--remainingTasks == 0) {
+		gameEvent->Trigger();
+	}
+}
+
+void ECSTaskExecutor::Dispatch(GraphTask* task, int32 lane)
+{
+	if (task->original->type == ESysTaskType::FreeTask) {
+		deques[lane]->Push(task);
+		WakeWorker();
+	}
+	else {
+		gameTasks.Enqueue(task);
+		gameEvent->Trigger();
+	}
+}
+
+void ECSTaskExecutor::Park(GraphTask* task, int32 slot, GraphTask* blocker, int32 lane)
+{
+	slots[slot].waiters.Push(task);
+
+	//the blocker can have released the slot before the push landed, and then nobody else would wake the waiters.
+	//If the slot has a new owner by now, waking them early only costs them another try
+	if (slots[slot].task.load() != blocker) {
+		WakeWaiters(slot, lane);
+	}
+}
+
+void ECSTaskExecutor::WakeWaiters(int32 slot, int32 lane)
+{
+	if (slots[slot].waiters.IsEmpty()) {
+		return;
+	}
+
+	//each waiter is popped by a single thread, even if the release and the park race for it
+	TArray<GraphTask*> parked;
+	slots[slot].waiters.PopAll(parked);
+	for (auto t : parked) {
+		Dispatch(t, lane);
+	}
+}
+
+GraphTask* ECSTaskExecutor::FindWork(int32 lane)
+{
+	if (GraphTask* task = deques[lane]->Pop()) {
+		return task;
+	}
+
+	//steal, starting from the next lane so the thieves spread out
+	const int32 numDeques = deques.Num();
+	for (int32 i = 1; i < numDeques; i++) {
+		if (GraphTask* task = deques[(lane + i) % numDeques]->Steal()) {
+			return task;
+		}
+	}
+	return nullptr;
+}
+
+bool ECSTaskExecutor::HasWork() const
+{
+	for (auto d : deques) {
+		if (!d->IsEmpty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ECSTaskExecutor::WakeWorker()
+{
+	if (sleepingWorkers.load() > 0) {
+		workEvent->Trigger();
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <ECS_Core.h>
+#include <atomic>
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Containers/LockFreeList.h"
+#include "Containers/Queue.h"
+
+struct GraphTask;
+
+//Chase-Lev work stealing deque. The owner thread pushes and pops from the bottom, any other thread can steal from the top.
+//Capacity is fixed, a task can only be in one deque at a time so it just needs to be bigger than the graph
+class ECSWorkDeque {
+public:
+	static constexpr int64 Capacity = 4096;
+
+	ECSWorkDeque();
+
+	//owner thread only
+	void Push(GraphTask* task);
+	//owner thread only
+	GraphTask* Pop();
+	//any thread
+	GraphTask* Steal();
+
+	bool IsEmpty() const {
+		return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+	}
+
+private:
+	//padding keeps the thieves and the owner from sharing a cache line
+	std::atomic<int64> top;
+	uint8 padTop[PLATFORM_CACHE_LINE_SIZE];
+	std::atomic<int64> bottom;
+	uint8 padBottom[PLATFORM_CACHE_LINE_SIZE];
+	std::atomic<GraphTask*> buffer[Capacity];
+};
+
+//Executes a compiled task graph. Each worker has its own deque and will steal from the others when it runs dry.
+//A finished task decrements the atomic counters of its successors, and the thread that finished it continues directly with the best ready one.
+//Conflicts between the dependencies of tasks are resolved through a small table of running slots, there are no locks on the task path.
+class ECSTaskExecutor {
+public:
+
+	//lane 0 is always the game thread, workers are lanes 1 to NumWorkers
+	static constexpr int32 GameThreadLane = 0;
+
+	explicit ECSTaskExecutor(int32 NumWorkers);
+	~ECSTaskExecutor();
+
+	int32 GetNumWorkers() const { return Workers.Num(); }
+
+	//starts the execution of the graph from its root task. Must be called from the game thread
+	//trace can be null
+	void Launch(GraphTask* root, int32 numTasks, ECS_Registry* reg, class ECSTaskTrace* _trace);
+
+	bool IsFinished() const { return remainingTasks.load() <= 0; }
+
+	//runs one ready game thread task, returns false if there was none
+	bool RunGameTask();
+
+	//the game thread as one more worker. Game thread tasks go first, when there are none it steals free tasks.
+	//Spins for a while once there is nothing to do, then sleeps until a game task is ready or the graph finishes
+	void RunGameThread();
+
+	void WorkerLoop(int32 lane);
+
+private:
+	struct RunningSlot {
+		std::atomic<GraphTask*> task{ nullptr };
+		//false while the owner is still checking for conflicts
+		std::atomic<bool> committed{ false };
+		//tasks that couldnt run because of the task in this slot, they are dispatched again when it is released
+		TLockFreePointerListUnordered<GraphTask, PLATFORM_CACHE_LINE_SIZE> waiters;
+	};
+
+	class WorkerRunnable : public FRunnable {
+	public:
+		WorkerRunnable(ECSTaskExecutor* _executor, int32 _lane) : executor(_executor), lane(_lane) {}
+
+		virtual uint32 Run() override {
+			executor->WorkerLoop(lane);
+			return 0;
+		}
+
+		ECSTaskExecutor* executor;
+		int32 lane;
+	};
+
+	struct Worker {
+		WorkerRunnable* runnable{ nullptr };
+		FRunnableThread* thread{ nullptr };
+	};
+
+	bool Conflicts(const GraphTask* task, const GraphTask* other) const;
+
+	//claims a running slot for the task if nothing running conflicts with it.
+	//Otherwise the task is parked on the slot that blocked it, and INDEX_NONE is returned
+	int32 AcquireSlot(GraphTask* task, int32 lane);
+	//frees the slot and dispatches its waiters
+	void ReleaseSlot(int32 slot, int32 lane);
+
+	//runs the task and then keeps going with ready successors on the same thread
+	void Execute(GraphTask* task, int32 lane);
+
+	//runs the setup of a parallel task and queues its chunks. Returns the chunk this thread continues with
+	GraphTask* StartChunks(GraphTask* task, int32 slot, int32 lane);
+	//the last chunk to finish also finishes the parent, in that case a continuation can be returned
+	GraphTask* RunChunk(GraphTask* chunk, int32 lane);
+
+	//decrements the successors and queues the ready ones. If allowed, returns a free task to continue with
+	GraphTask* FinishTask(GraphTask* task, int32 lane, bool bAllowContinuation);
+
+	//counts a finished task, chunks included, and wakes the game thread once the graph is done
+	void CompleteTask();
+
+	void Dispatch(GraphTask* task, int32 lane);
+	//waits for blocker to leave the slot
+	void Park(GraphTask* task, int32 slot, GraphTask* blocker, int32 lane);
+	void WakeWaiters(int32 slot, int32 lane);
+
+	GraphTask* FindWork(int32 lane);
+	bool HasWork() const;
+	void WakeWorker();
+
+	ECS_Registry* registry{ nullptr };
+	class ECSTaskTrace* trace{ nullptr };
+
+	TArray<ECSWorkDeque*> deques;
+	TArray<Worker> Workers;
+	RunningSlot* slots{ nullptr };
+	int32 numSlots{ 0 };
+
+	//game thread tasks, multiple producers and only the game thread consumes
+	TQueue<GraphTask*, EQueueMode::Mpsc> gameTasks;
+
+	std::atomic<int32> remainingTasks{ 0 };
+	std::atomic<int32> sleepingWorkers{ 0 };
+	std::atomic<bool> bStopping{ false };
+
+	FEvent* workEvent{ nullptr };
+	FEvent* gameEvent{ nullptr };
+};
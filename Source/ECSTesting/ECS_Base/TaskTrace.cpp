@@ -0,0 +1,116 @@
+#include "TaskTrace.h"
+#include "SystemTasks.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+static FString EscapeJson(const FString& str)
+{
+	return str.Replace(TEXT("\\"), TEXT("\\\\")).Replace(TEXT("\""), TEXT("\\\""));
+}
+
+static const TCHAR* TaskTypeName(const GraphTask* task)
+{
+	switch (task->original->type) {
+	case ESysTaskType::GameThread: return TEXT("GameThread");
+	case ESysTaskType::SyncPoint: return TEXT("SyncPoint");
+	case ESysTaskType::FreeTask: return TEXT("FreeTask");
+	}
+	return TEXT("Unknown");
+}
+
+ECSTaskTrace::ECSTaskTrace(int32 numLanes, int32 _framesPerFile, const FString& _outputDir)
+{
+	lanes.SetNum(numLanes);
+	laneThreads.SetNumZeroed(numLanes);
+	outputDir = _outputDir;
+	sessionName = FDateTime::Now().ToString();
+	baseCycles = FPlatformTime::Cycles64();
+	gameThreadId = FPlatformTLS::GetCurrentThreadId();
+	SetFramesPerFile(_framesPerFile);
+}
+
+ECSTaskTrace::~ECSTaskTrace()
+{
+	Flush();
+}
+
+void ECSTaskTrace::BeginFrame()
+{
+	frames.Add({ FPlatformTime::Cycles64(), 0, frameIndex });
+}
+
+void ECSTaskTrace::EndFrame()
+{
+	frames.Last().end = FPlatformTime::Cycles64();
+	frameIndex++;
+
+	if (frames.Num() >= framesPerFile) {
+		Flush();
+	}
+}
+
+void ECSTaskTrace::AddSpan(int32 lane, const GraphTask* task, uint64 startCycles, uint64 endCycles)
+{
+	const uint32 threadId = FPlatformTLS::GetCurrentThreadId();
+	laneThreads[lane] = threadId;
+
+	//a task that was never marked ready is counted as starting right away
+	const uint64 ready = task->readyCycles != 0 ? FMath::Min(task->readyCycles, startCycles) : startCycles;
+	lanes[lane].Add({ task, ready, startCycles, endCycles, threadId, frameIndex });
+}
+
+double ECSTaskTrace::ToMicroseconds(uint64 cycles) const
+{
+	return FPlatformTime::ToMilliseconds64(cycles - baseCycles) * 1000.0;
+}
+
+void ECSTaskTrace::Flush()
+{
+	if (frames.Num() == 0) {
+		return;
+	}
+
+	FString json = TEXT("{\"traceEvents\":[\n");
+	json += FString::Printf(TEXT("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ECS Task Graph\"}}"));
+
+	//name the threads after their lane
+	for (int32 lane = 0; lane < lanes.Num(); lane++) {
+		if (laneThreads[lane] == 0) continue;
+
+		const FString threadName = lane == 0 ? FString(TEXT("GameThread")) : FString::Printf(TEXT("ECSWorker%d"), lane - 1);
+		json += FString::Printf(TEXT(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}"),
+			laneThreads[lane], *threadName);
+	}
+
+	//frames go on the game thread, the game thread tasks nest inside them
+	for (const Frame& f : frames) {
+		json += FString::Printf(TEXT(",\n{\"name\":\"Frame %d\",\"cat\":\"Frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}"),
+			f.index, gameThreadId, ToMicroseconds(f.start), ToMicroseconds(f.end) - ToMicroseconds(f.start));
+	}
+
+	for (int32 lane = 0; lane < lanes.Num(); lane++) {
+		const FString laneName = lane == 0 ? FString(TEXT("game")) : FString::Printf(TEXT("worker %d"), lane - 1);
+
+		for (const Span& s : lanes[lane]) {
+			const GraphTask* task = s.task;
+			const FString chain = EscapeJson(task->original->ownerGraph->name);
+			const double start = ToMicroseconds(s.start);
+			const double duration = ToMicroseconds(s.end) - start;
+			const double wait = start - ToMicroseconds(s.ready);
+
+			json += FString::Printf(TEXT(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,")
+				TEXT("\"args\":{\"chain\":\"%s\",\"chainIndex\":%d,\"chunk\":%d,\"readyWaitUs\":%.3f,\"lane\":\"%s\",\"frame\":%d}}"),
+				*EscapeJson(task->TaskName), TaskTypeName(task), s.threadId, start, duration,
+				*chain, task->chainIndex, task->chunkParent ? task->chunkIndex : -1, wait, *laneName, s.frame);
+		}
+		lanes[lane].Reset();
+	}
+	json += TEXT("\n]}\n");
+	frames.Reset();
+
+	const FString fileName = FString::Printf(TEXT("ECSTrace_%s_%03d.json"), *sessionName, fileIndex++);
+	const FString path = FPaths::Combine(outputDir, fileName);
+	if (!FFileHelper::SaveStringToFile(json, *path)) {
+		UE_LOG(LogFlying, Warning, TEXT("Could not write ECS trace file %s"), *path);
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <ECS_Core.h>
+
+struct GraphTask;
+
+//Records one span per graph task execution and writes them as trace event json, which loads in chrome://tracing and Perfetto.
+//Every lane has its own buffer. A lane is only used by one thread at a time, so recording a span doesnt need any lock.
+//Spans keep a pointer to their task, so the trace has to be flushed before the graph is destroyed
+class ECSTaskTrace {
+public:
+	//lane 0 is the game thread, the rest are the executor workers
+	ECSTaskTrace(int32 numLanes, int32 framesPerFile, const FString& outputDir);
+	~ECSTaskTrace();
+
+	//game thread only, while the graph is not running
+	void BeginFrame();
+	void EndFrame();
+
+	//writes everything recorded so far into a new file
+	void Flush();
+
+	void AddSpan(int32 lane, const GraphTask* task, uint64 startCycles, uint64 endCycles);
+
+	void SetFramesPerFile(int32 frames) { framesPerFile = FMath::Max(frames, 1); }
+	const FString& GetOutputDir() const { return outputDir; }
+
+private:
+	struct Span {
+		const GraphTask* task;
+		uint64 ready;
+		uint64 start;
+		uint64 end;
+		uint32 threadId;
+		int32 frame;
+	};
+
+	struct Frame {
+		uint64 start;
+		uint64 end;
+		int32 index;
+	};
+
+	double ToMicroseconds(uint64 cycles) const;
+
+	TArray<TArray<Span>> lanes;
+	TArray<uint32> laneThreads;
+	TArray<Frame> frames;
+
+	FString outputDir;
+	FString sessionName;
+	int32 framesPerFile{ 1 };
+	int32 frameIndex{ 0 };
+	int32 fileIndex{ 0 };
+	uint64 baseCycles{ 0 };
+	uint32 gameThreadId{ 0 };
+};
+
+//records a span for the task from construction to destruction. Does nothing if there is no trace
+struct ECSTraceScope {
+	ECSTraceScope(ECSTaskTrace* _trace, int32 _lane, const GraphTask* _task)
+		: trace(_trace), lane(_lane), task(_task), start(_trace ? FPlatformTime::Cycles64() : 0) {}
+
+	~ECSTraceScope() {
+		if (trace) {
+			trace->AddSpan(lane, task, start, FPlatformTime::Cycles64());
+		}
+	}
+
+	ECSTaskTrace* trace;
+	int32 lane;
+	const GraphTask* task;
+	uint64 start;
+};
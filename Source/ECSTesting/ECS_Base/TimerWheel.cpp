@@ -0,0 +1,37 @@
+#include "TimerWheel.h"
+
+void ECSTimerWheel::Schedule(EntityID Entity, uint64 Step)
+{
+	Step = FMath::Max(Step, NextStep);
+	NumTimers++;
+
+	if (Step - NextStep < NumSlots)
+	{
+		Slots[Step & (NumSlots - 1)].Add({ Entity, Step });
+	}
+	else
+	{
+		FarTimers.HeapPush({ Entity, Step }, FarOrder());
+	}
+}
+
+void ECSTimerWheel::Reset(uint64 Step)
+{
+	for (auto& Slot : Slots)
+	{
+		Slot.Reset();
+	}
+	FarTimers.Reset();
+	NextStep = Step;
+	NumTimers = 0;
+}
+
+void ECSTimerWheel::PullFarTimers(uint64 FirstStep)
+{
+	while (FarTimers.Num() > 0 && FarTimers.HeapTop().Step - FirstStep < NumSlots)
+	{
+		Timer t;
+		FarTimers.HeapPop(t, FarOrder(), false);
+		Slots[t.Step & (NumSlots - 1)].Add(t);
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "ECS_Core.h"
+
+//Timers of entities, keyed by the absolute simulation step they expire on.
+//The next NumSlots steps each have a bucket, so scheduling and expiring a timer in that window is constant time.
+//Timers further out wait in a min heap and drop into their bucket once the window reaches them.
+//Advancing only touches the buckets of the steps that passed, no matter how many timers are waiting.
+//
+//A timer is never cancelled. Whoever expires it has to check that it is still valid, the entity can be gone or scheduled again
+class ECSTimerWheel {
+public:
+	//about 17 seconds at 60 steps per second
+	static constexpr int32 NumSlots = 1024;
+
+	struct Timer {
+		EntityID Entity;
+		uint64 Step;
+	};
+
+	//steps already expired go to the next step to be advanced
+	void Schedule(EntityID Entity, uint64 Step);
+
+	//calls Body with every timer due up to and including the step. Body cant schedule new timers
+	template<typename Func>
+	void Advance(uint64 Step, Func&& Body) {
+		for (; NextStep <= Step; NextStep++) {
+			TArray<Timer>& Slot = Slots[NextStep & (NumSlots - 1)];
+			for (const Timer& t : Slot) {
+				Body(t);
+			}
+			NumTimers -= Slot.Num();
+			Slot.Reset();
+
+			PullFarTimers(NextStep + 1);
+		}
+	}
+
+	int32 Num() const { return NumTimers; }
+
+	//the step the next Advance starts from
+	uint64 GetNextStep() const { return NextStep; }
+
+	//drops every timer, the wheel starts again from the step
+	void Reset(uint64 Step);
+
+private:
+	struct FarOrder {
+		bool operator()(const Timer& A, const Timer& B) const { return A.Step < B.Step; }
+	};
+
+	//moves the heap timers that fall inside the window starting at the step into their buckets
+	void PullFarTimers(uint64 FirstStep);
+
+	TArray<Timer> Slots[NumSlots];
+	TArray<Timer> FarTimers;
+	uint64 NextStep{ 0 };
+	int32 NumTimers{ 0 };
+};
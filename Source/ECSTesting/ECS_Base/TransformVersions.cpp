@@ -0,0 +1,65 @@
+#include "TransformVersions.h"
+#include "ECS_Core.h"
+#include "ECS_BaseComponents.h"
+#include "Misc/ScopeRWLock.h"
+
+template<typename T>
+static void AddSetTrigger(flecs::world& Registry, ECSTransformVersions* Versions)
+{
+	//triggers live as long as the registry, and so does the world that owns the versions
+	flecs::system<T> trigger(Registry);
+	trigger.kind(flecs::OnSet).iter([Versions](flecs::iter it, T* values) {
+		Versions->MarkTable(it.table_type().c_ptr());
+	});
+}
+
+void ECSTransformVersions::Initialize(flecs::world& Registry)
+{
+	AddSetTrigger<FPosition>(Registry, this);
+	AddSetTrigger<FRotationComponent>(Registry, this);
+	AddSetTrigger<FScale>(Registry, this);
+}
+
+void ECSTransformVersions::MarkTable(ecs_type_t Table)
+{
+	std::atomic<uint64>* Version = nullptr;
+	{
+		FRWScopeLock ReadLock(Lock, SLT_ReadOnly);
+		if (const TUniquePtr<std::atomic<uint64>>* Found = Versions.Find(Table))
+		{
+			Version = Found->Get();
+		}
+	}
+
+	//first time the table is written
+	if (!Version)
+	{
+		FRWScopeLock WriteLock(Lock, SLT_Write);
+		TUniquePtr<std::atomic<uint64>>& Slot = Versions.FindOrAdd(Table);
+		if (!Slot)
+		{
+			Slot = MakeUnique<std::atomic<uint64>>(0);
+		}
+		Version = Slot.Get();
+	}
+
+	//every task of a phase runs on the same step, the chunks of a table all store the same value
+	Version->store(Clock->StepCount, std::memory_order_relaxed);
+}
+
+void ECSTransformVersions::MarkQuery(ecs_query_t* Query)
+{
+	ecs_iter_t it = ecs_query_iter(Query);
+	while (ecs_query_next(&it))
+	{
+		MarkTable(ecs_iter_type(&it));
+	}
+}
+
+bool ECSTransformVersions::ChangedSince(ecs_type_t Table, uint64 Step) const
+{
+	FRWScopeLock ReadLock(Lock, SLT_ReadOnly);
+	const TUniquePtr<std::atomic<uint64>>* Found = Versions.Find(Table);
+	const uint64 Version = Found ? (*Found)->load(std::memory_order_relaxed) : 0;
+	return Version >= Step;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "flecs/flecs.h"
+#include <atomic>
+
+struct ECSWorldClock;
+
+//Change versions of the transform components (FPosition, FRotationComponent and FScale), one per table.
+//Tables are keyed by their type, flecs has a single table for each type.
+//The version of a table is the simulation step its transforms were last written on, so the systems that copy transforms out
+//can skip the tables that didnt change since they last looked. Tables that were never written are on version 0.
+//
+//A table gets marked by the ForEach and ForIter tasks that write a transform component, when one gets set (spawns and set commands),
+//and by hand from anything else that writes them. A table that is marked is only known to have changed, not which rows did.
+class ECSTransformVersions {
+public:
+	explicit ECSTransformVersions(const ECSWorldClock* InClock) : Clock(InClock) {}
+
+	//creates the triggers that mark the tables of the entities that get a transform component set
+	void Initialize(flecs::world& Registry);
+
+	//the transforms of the table were written on the current step. Any thread
+	void MarkTable(ecs_type_t Table);
+
+	//marks every table the query matches
+	void MarkQuery(ecs_query_t* Query);
+
+	//true if the transforms of the table were written on the step or after it. Any thread
+	bool ChangedSince(ecs_type_t Table, uint64 Step) const;
+
+private:
+	const ECSWorldClock* Clock;
+
+	//versions are never removed, so their address holds while the map grows
+	TMap<ecs_type_t, TUniquePtr<std::atomic<uint64>>> Versions;
+	mutable FRWLock Lock;
+};
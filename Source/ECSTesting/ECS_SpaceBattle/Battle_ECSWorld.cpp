@@ -25,6 +25,7 @@ void A_ECSWorldActor::BeginPlay()
 		TaskScheduler = MakeUnique<ECSSystemScheduler>();
 		
 		ECSWorld->CreateAndRegisterSystem<CopyTransformToECSSystem>();
+		ECSWorld->CreateAndRegisterSystem<TransformInterpolationSystem>();
 		ECSWorld->CreateAndRegisterSystem<BoidSystem>();
 
 		ECSWorld->CreateAndRegisterSystem<MovementSystem>();
@@ -57,6 +58,35 @@ namespace ECSCVars
 		TEXT("Whether to run the ECS task graph in multiple cores\n")
 		TEXT("0: Disable, 1: Enable"),
 		ECVF_Default);
+
+	static int32 EnableTrace = 0;
+	FAutoConsoleVariableRef CVarECSTrace(
+		TEXT("p.ECSTrace"),
+		EnableTrace,
+		TEXT("Records every ECS task execution as chrome trace json into Saved/Profiling/ECSTrace\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static int32 TraceFramesPerFile = 300;
+	FAutoConsoleVariableRef CVarECSTraceFrames(
+		TEXT("p.ECSTraceFrames"),
+		TraceFramesPerFile,
+		TEXT("How many frames go into each ECS trace file before it rolls over to a new one"),
+		ECVF_Default);
+
+	static float StepTime = 1.f / 60.f;
+	FAutoConsoleVariableRef CVarECSStepTime(
+		TEXT("p.ECSStepTime"),
+		StepTime,
+		TEXT("Duration in seconds of one fixed simulation step of the ECS"),
+		ECVF_Default);
+
+	static int32 MaxSubsteps = 4;
+	FAutoConsoleVariableRef CVarECSMaxSubsteps(
+		TEXT("p.ECSMaxSubsteps"),
+		MaxSubsteps,
+		TEXT("Max simulation steps the ECS runs in a single frame, time past that is dropped"),
+		ECVF_Default);
 }
 // Called every frame
 void A_ECSWorldActor::Tick(float DeltaTime)
@@ -67,13 +97,16 @@ void A_ECSWorldActor::Tick(float DeltaTime)
 
 	
 
-	TaskScheduler->Reset();
-	TaskScheduler->registry = &ECSWorld->registry;
+	TaskScheduler->SetTracing(ECSCVars::EnableTrace == 1, ECSCVars::TraceFramesPerFile);
 
-	for(auto sys : ECSWorld->systems){
-		 sys->schedule(TaskScheduler.Get());
+	//the task graph is only rebuilt when the systems change
+	if (TaskScheduler->NeedsRebuild(ECSWorld.Get()))
+	{
+		TaskScheduler->Rebuild(ECSWorld.Get());
 	}
 
-	TaskScheduler->Run(ECSCVars::EnableParallel == 1,ECSWorld->registry);
+	ECSWorld->Clock.Advance(DeltaTime, ECSCVars::StepTime, ECSCVars::MaxSubsteps);
+
+	TaskScheduler->RunFrame(ECSWorld.Get(), ECSCVars::EnableParallel == 1);
 }
 
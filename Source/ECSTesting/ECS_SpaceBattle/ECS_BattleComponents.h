@@ -59,6 +59,9 @@ struct FExplosion {
 		float Duration;
 	UPROPERTY(EditAnywhere)
 		float MaxScale;
+
+	//simulation step the explosion is destroyed on, worked out by the ExplosionSystem when the explosion is set
+	uint64 ExpiryStep = 0;
 };
 
 
@@ -2,13 +2,67 @@
 #include "SystemTasks.h"
 #include "DrawDebugHelpers.h"
 
+namespace ECSCVars
+{
+	static int32 IncrementalGrid = 1;
+	FAutoConsoleVariableRef CVarECSIncrementalGrid(
+		TEXT("p.ECSIncrementalGrid"),
+		IncrementalGrid,
+		TEXT("Only moves the boids that changed cell instead of building the spatial grid from scratch every step\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static int32 ValidateBoidKernel = 0;
+	FAutoConsoleVariableRef CVarECSValidateBoidKernel(
+		TEXT("p.ECSValidateBoidKernel"),
+		ValidateBoidKernel,
+		TEXT("Runs the old one item at a time boid steering next to the vector kernel, and logs when they dont match. Only without far field or neighbour caps\n")
+		TEXT("0: Disable, 1: Enable"),
+		ECVF_Default);
+
+	static float BoidOpeningAngle = 0.f;
+	FAutoConsoleVariableRef CVarECSBoidOpeningAngle(
+		TEXT("p.ECSBoidOpeningAngle"),
+		BoidOpeningAngle,
+		TEXT("Far field for the boids. Grid cells that look smaller than this angle (cell size / distance) steer as a single point per faction.\n")
+		TEXT("0 disables it, around 0.7 starts to skip the outer cells of the boid radius, bigger is faster and less accurate"),
+		ECVF_Default);
+
+	static int32 ShipMaxNeighbours = 0;
+	FAutoConsoleVariableRef CVarECSShipMaxNeighbours(
+		TEXT("p.ECSShipMaxNeighbours"),
+		ShipMaxNeighbours,
+		TEXT("Most ships of its own faction a ship avoids each step, closest cells first. 0 for no limit"),
+		ECVF_Default);
+
+	static int32 ProjectileMaxNeighbours = 0;
+	FAutoConsoleVariableRef CVarECSProjectileMaxNeighbours(
+		TEXT("p.ECSProjectileMaxNeighbours"),
+		ProjectileMaxNeighbours,
+		TEXT("Most enemies a projectile seeks towards each step, closest cells first. 0 for no limit"),
+		ECVF_Default);
+}
+
+static void ValidateSteering(const ECSSpatialGrid& Grid, const FVector& Steering, const ECSSpatialGrid::SteeringQuery& Query)
+{
+	const FVector Reference = Grid.ReferenceSteering(Query);
+	const FVector& Origin = Query.Origin;
+
+	//the kernel adds in a different order and uses a faster inverse square root, so it is only close
+	const float Tolerance = 1e-3f * FMath::Max(Reference.Size(), FMath::Abs(Query.Strength));
+	if (!Steering.Equals(Reference, Tolerance))
+	{
+		UE_LOG(LogFlying, Warning, TEXT("Boid steering kernel mismatch at %s: kernel %s, reference %s"), *Origin.ToString(), *Steering.ToString(), *Reference.ToString());
+	}
+}
+
 void SpaceshipSystem::update(ECS_Registry& registry, float dt)
 {
 	assert(OwnerActor);
 	SCOPE_CYCLE_COUNTER(STAT_Explosion);
 
 
-	q_ships.each([&, dt](auto entity, FSpaceship& ship, FRotationComponent& rotation, FVelocity& vel) {
+	q_ships.each([&, dt](auto entity, const FSpaceship& ship, FRotationComponent& rotation, const FVelocity& vel) {
 		
 		rotation.rot = vel.vel.Rotation().Quaternion();
 	});
@@ -20,58 +74,31 @@ void SpaceshipSystem::schedule(ECSSystemScheduler* sysScheduler)
 
 	init_query(q_ships, sysScheduler->registry);
 
-	TaskDependencies deps;
-
-	deps.AddWrite< FRotationComponent >();
-	deps.AddRead < FSpaceship > ();
-	deps.AddRead < FVelocity > ();
-
 	builder.AddDependency("Boids");
-	builder.AddTask(deps,
-		[=](ECS_Registry& reg) {
-			this->update(reg, 1.0 / 60.0);
-		}
-	);
+	builder.AddParallelForEach(q_ships, TaskDependencies::FromQueries(q_ships),
+		[](auto entity, const FSpaceship& ship, FRotationComponent& rotation, const FVelocity& vel) {
+			rotation.rot = vel.vel.Rotation().Quaternion();
+		});
 
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
 }
 
 
-void BoidSystem::AddToGridmap(flecs::entity ent, FPosition& pos)
+void BoidSystem::initialize(AActor* _Owner, ECS_World* _World)
 {
-	const FIntVector GridLoc = FIntVector(pos.pos / GRID_DIMENSION);
-	auto SearchGrid = GridMap.Find(GridLoc);
-
-	GridItem item;
-	item.ID.handle = ent.id();
-	item.Position = pos.pos;
+	System::initialize(_Owner, _World);
 
-
-
-	if (ent.has<FFaction>())
-	{
-		item.Faction = ent.get<FFaction>()->faction;
-	}
-	else
-	{
-		item.Faction = EFaction::Neutral;
-	}
-
-
-	if (!SearchGrid)
-	{
-		TArray<GridItem> NewGrid;
-
-		NewGrid.Reserve(10);
-		NewGrid.Add(item);
-
-		GridMap.Emplace(GridLoc, std::move(NewGrid));
-
-	}
-	else
-	{
-		SearchGrid->Add(item);
-	}
+	//removing the FGridMap of an entity, or destroying it, takes it out of the grid. The last entity of its cell takes the slot.
+	//triggers only run when the commands are applied, never while the grid is being updated
+	AddRemoveTrigger<FGridMap>([this](flecs::iter it, FGridMap* links) {
+		for (auto i : it)
+		{
+			if (links[i].Cell != INDEX_NONE)
+			{
+				Grid.RemoveItem(*World->GetRegistry(), links[i]);
+			}
+		}
+	});
 }
 
 void BoidSystem::update(ECS_Registry& registry, float dt)
@@ -84,157 +111,175 @@ void BoidSystem::update(ECS_Registry& registry, float dt)
 	if (bDebugGridMap)
 	{
 		const float MaxUnits = 5.0;
-		for (auto& g : GridMap)
+		for (const ECSSpatialGrid::Cell& g : Grid.GetCells())
 		{
-			const FVector BoxMin = FVector(g.Key) * GRID_DIMENSION;
+			if (g.Count == 0) continue;
+			const FVector BoxMin = FVector(g.Location) * GRID_DIMENSION;
 			const FVector BoxMax = BoxMin + FVector(GRID_DIMENSION, GRID_DIMENSION, GRID_DIMENSION);
 			const FVector BoxCenter = BoxMin + FVector(GRID_DIMENSION, GRID_DIMENSION, GRID_DIMENSION) / 2.0;
-			const FColor BoxColor = FColor::MakeRedToGreenColorFromScalar(g.Value.Num() / MaxUnits);
+			const FColor BoxColor = FColor::MakeRedToGreenColorFromScalar(g.Count / MaxUnits);
 			DrawDebugBox(OwnerActor->GetWorld(), BoxCenter, FVector(GRID_DIMENSION, GRID_DIMENSION, GRID_DIMENSION) / 2.0, BoxColor);
 		}
 	}
 }
 
-//PRAGMA_DISABLE_OPTIMIZATION
 void BoidSystem::UpdateAllBoids(ECS_Registry& registry, float dt)
-{
-
-	
-	unsigned int NumShips = 0;
-	unsigned int NumProjectiles = 0;
+{//update everything as a single chunk
+	SCOPE_CYCLE_COUNTER(STAT_Boids);
 
+	QueryChunks projectiles;
+	projectiles.Start(q_projectiles.c_ptr());
+	QueryChunks ships;
+	ships.Start(q_ships.c_ptr());
 
+	UpdateBoidsChunk(projectiles, ships, 0, 1, dt);
+}
 
-	ProjArray.Reset();
-	SpaceshipArray.Reset();
+void BoidSystem::UpdateBoidsChunk(const QueryChunks& projectiles, const QueryChunks& ships, int32 chunk, int32 numChunks, float dt)
+{
+	projectiles.ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* table) {
+		flecs::iter it(table);
+		auto proj = ECSTableColumn<const FProjectile>(table);
+		auto pos = ECSTableColumn<const FPosition>(table);
+		auto vel = ECSTableColumn<FVelocity>(table);
+		auto faction = ECSTableColumn<const FFaction>(table);
+		for (auto i : it)
+		{
+			update_projectile(proj[i], pos[i], vel[i], faction[i], dt);
+		}
+	});
 
-	{
-		SCOPE_CYCLE_COUNTER(STAT_Boids);
+	ships.ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* table) {
+		flecs::iter it(table);
+		auto ship = ECSTableColumn<const FSpaceship>(table);
+		auto pos = ECSTableColumn<const FPosition>(table);
+		auto vel = ECSTableColumn<FVelocity>(table);
+		auto faction = ECSTableColumn<const FFaction>(table);
+		for (auto i : it)
+		{
+			update_spaceship(ship[i], pos[i], vel[i], faction[i], dt);
+		}
+	});
+}
 
-		//TypedLinearMemory<ProjectileData> ProjArray(World->ScratchPad);
-		//copy projectile data into array so we can do a parallel update later
+void BoidSystem::update_projectile(const FProjectile& proj, const FPosition& pos, FVelocity& vel, const FFaction& faction, float dt)
+{
+	//unpack projectile data
+	const FVector ProjPosition = pos.pos;
+	const EFaction ProjFaction = faction.faction;
+	const float ProjSeekStrenght = proj.HeatSeekStrenght;
+	const float ProjMaxVelocity = proj.MaxVelocity;
+	FVector& ProjVelocity = vel.vel;
 
-		q_projectiles.each([&](auto et, FProjectile& proj, FPosition& pos, FVelocity& vel, FFaction& fact) {
-			ProjectileData Projectile;
-			Projectile.faction = fact;
-			Projectile.pos = pos;
-			Projectile.proj = proj;
 
-			Projectile.vel = &vel;
-			ProjArray.Add(Projectile);
-			NumProjectiles++;
-			});
+	//seek towards everything of other factions
+	const float ProjCheckRadius = 1000;
+	const float SeekStrenght = ProjSeekStrenght * dt;
+	ECSSpatialGrid::SteeringQuery Query{ ProjPosition, ProjCheckRadius, ProjFaction, true, SeekStrenght };
+	Query.OpeningAngle = OpeningAngle;
+	Query.MaxNeighbours = ECSCVars::ProjectileMaxNeighbours;
 
-		//TypedLinearMemory<SpaceshipData> SpaceshipArray(World->ScratchPad);
-		//copy spaceship data into array so we can do a paralle update later
-		q_ships.each([&](auto et, FSpaceship& ship, FPosition& pos, FVelocity& vel, FFaction& fact) {
-			SpaceshipData Ship;
-			Ship.faction = fact;
-			Ship.pos = pos;
-			Ship.ship = ship;
-
-			Ship.vel = &vel;
-			SpaceshipArray.Add(Ship);
-			NumShips++;
-			});
-	}
+	const FVector Seek = Grid.SumSteering(Query);
+	if (ECSCVars::ValidateBoidKernel && Query.OpeningAngle == 0.f && Query.MaxNeighbours <= 0)
 	{
-	SCOPE_CYCLE_COUNTER(STAT_Boids);
-
-		//update both projectiles at ships at once for best parallelism
-		ParallelFor(NumProjectiles + NumShips, [&](int32 Index){
-			if (Index < (int32)NumProjectiles)
-			{
-				ProjectileData data = ProjArray[Index];
-
-				update_projectile(data, dt);
-			}
-			else {
-				Index = Index - NumProjectiles;
-				SpaceshipData data = SpaceshipArray[Index];
-				update_spaceship(data, dt);
-			}
-		});
+		ValidateSteering(Grid, Seek, Query);
 	}
+	ProjVelocity += Seek;
+
+	ProjVelocity = ProjVelocity.GetClampedToMaxSize(ProjMaxVelocity);
 }
-//PRAGMA_ENABLE_OPTIMIZATION
 
-void BoidSystem::update_projectile(ProjectileData& data, float dt)
+void BoidSystem::update_spaceship(const FSpaceship& ship, const FPosition& pos, FVelocity& vel, const FFaction& faction, float dt)
 {
-	//unpack projectile data
-	const FVector ProjPosition = data.pos.pos;
-	const EFaction ProjFaction = data.faction.faction;
-	const float ProjSeekStrenght = data.proj.HeatSeekStrenght;
-	const float ProjMaxVelocity = data.proj.MaxVelocity;
-	FVector& ProjVelocity = data.vel->vel;
+	//unpack ship variables
+	const FVector ShipPosition = pos.pos;
+	const EFaction ShipFaction = faction.faction;
+	const float ShipAvoidanceStrenght = ship.AvoidanceStrenght;
+	const float ShipMaxVelocity = ship.MaxVelocity;
+	FVector& ShipVelocity = vel.vel;
+	const FVector ShipTarget = ship.TargetMoveLocation;
+
+	//avoid the ships of the same faction, the negative strength pushes away from them
+	const float shipCheckRadius = 1000;
+	const float AvoidanceStrenght = -ShipAvoidanceStrenght * dt;
+	ECSSpatialGrid::SteeringQuery Query{ ShipPosition, shipCheckRadius, ShipFaction, false, AvoidanceStrenght };
+	Query.OpeningAngle = OpeningAngle;
+	Query.MaxNeighbours = ECSCVars::ShipMaxNeighbours;
 
+	const FVector Avoidance = Grid.SumSteering(Query);
+	if (ECSCVars::ValidateBoidKernel && Query.OpeningAngle == 0.f && Query.MaxNeighbours <= 0)
+	{
+		ValidateSteering(Grid, Avoidance, Query);
+	}
+	ShipVelocity += Avoidance;
 
-	const float ProjCheckRadius = 1000;
-	Foreach_EntitiesInRadius(ProjCheckRadius, ProjPosition, [&](GridItem& item) {
+	FVector ToTarget = ShipTarget - ShipPosition;
+	ToTarget.Normalize();
 
-		if (item.Faction != ProjFaction)
-		{
-			const FVector TestPosition = item.Position;
+	ShipVelocity += (ToTarget * 500 * dt);
+	ShipVelocity = ShipVelocity.GetClampedToMaxSize(ShipMaxVelocity);
+}
 
-			const float DistSquared = FVector::DistSquared(TestPosition, ProjPosition);
+void BoidSystem::UpdateGridmap(ECS_Registry& registry)
+{//add everything to the gridmap, as a single chunk
+	SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
 
-			const float AvoidanceDistance = ProjCheckRadius * ProjCheckRadius;
-			const float DistStrenght = FMath::Clamp(1.0 - (DistSquared / (AvoidanceDistance)), 0.1, 1.0) * dt;
-			const FVector AvoidanceDirection = TestPosition - ProjPosition;
+	QueryChunks split;
+	split.Start(q_grid.c_ptr());
 
-			ProjVelocity += (AvoidanceDirection.GetSafeNormal() * ProjSeekStrenght * DistStrenght);
-		}
-	});
+	Grid.BeginBuild(split.totalRows, 1);
+	GatherGridChunk(split, 0, 1);
+	Grid.MergeChunks();
+	Grid.ScatterChunk(0);
 
-	ProjVelocity = ProjVelocity.GetClampedToMaxSize(ProjMaxVelocity);
+	//the cells arent summarized on this path
+	OpeningAngle = 0.f;
 }
 
-void BoidSystem::update_spaceship(SpaceshipData& data/*TypedLinearMemory<SpaceshipData> SpaceshipArray, int32 Index*/, float dt)
+//column of a component the query doesnt ask for, null if the table doesnt have it
+template<typename T>
+static const T* OptionalColumn(const ecs_iter_t* it)
 {
-	
-
-	//unpack ship variables from the array
-	const FVector ShipPosition = data.pos.pos;
-	const EFaction ShipFaction = data.faction.faction;
-	const float ShipAvoidanceStrenght = data.ship.AvoidanceStrenght;
-	const float ShipMaxVelocity = data.ship.MaxVelocity;
-	FVector& ShipVelocity = data.vel->vel;
-	const FVector ShipTarget = data.ship.TargetMoveLocation;
-
-	const float shipCheckRadius = 1000;
-	Foreach_EntitiesInRadius(shipCheckRadius, ShipPosition, [&](GridItem& item) {
+	return ECSTableColumn<const T>(it);
+}
 
-		if (item.Faction == ShipFaction)
+void BoidSystem::GatherGridChunk(const QueryChunks& split, int32 chunk, int32 numChunks)
+{
+	const int32 begin = split.ChunkBegin(chunk, numChunks);
+	Grid.BeginChunk(chunk, begin, split.ChunkBegin(chunk + 1, numChunks));
+
+	int32 index = begin;
+	split.ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* table) {
+		flecs::iter it(table);
+		auto links = ECSTableColumn<FGridMap>(table);
+		auto pos = ECSTableColumn<const FPosition>(table);
+
+		//not every table has a faction or a velocity, they are read from the table instead of being part of the query
+		const FFaction* faction = OptionalColumn<FFaction>(table);
+		const FVelocity* vel = OptionalColumn<FVelocity>(table);
+		for (auto i : it)
 		{
-			const FVector TestPosition = item.Position;
-
-			const float DistSquared = FVector::DistSquared(TestPosition, ShipPosition);
-
-			const float AvoidanceDistance = shipCheckRadius * shipCheckRadius;
-			const float DistStrenght = FMath::Clamp(1.0 - (DistSquared / (AvoidanceDistance)), 0.1, 1.0) * dt;
-			const FVector AvoidanceDirection = ShipPosition - TestPosition;
-
-			ShipVelocity += AvoidanceDirection.GetSafeNormal() * ShipAvoidanceStrenght * DistStrenght;
+			Grid.SetItem(chunk, index++, table->entities[i], &links[i], pos[i].pos,
+				vel ? vel[i].vel : FVector::ZeroVector, faction ? faction[i].faction : EFaction::Neutral);
 		}
 	});
-
-	FVector ToTarget = ShipTarget - ShipPosition;
-	ToTarget.Normalize();
-
-	ShipVelocity += (ToTarget * 500 * dt);
-	ShipVelocity = ShipVelocity.GetClampedToMaxSize(ShipMaxVelocity);
 }
 
-void BoidSystem::UpdateGridmap(ECS_Registry& registry)
-{//add everything to the gridmap
-	GridMap.Empty(50);
-	{
-		SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
-		q_grid.each([&](auto et, FGridMap grid, FPosition& pos) {
-			
-			AddToGridmap(et, pos);
-		});
-	}
+void BoidSystem::RefreshGridChunk(const QueryChunks& split, int32 chunk, int32 numChunks)
+{
+	split.ForEachInChunk(chunk, numChunks, [&](ecs_iter_t* table) {
+		flecs::iter it(table);
+		auto links = ECSTableColumn<FGridMap>(table);
+		auto pos = ECSTableColumn<const FPosition>(table);
+
+		const FFaction* faction = OptionalColumn<FFaction>(table);
+		const FVelocity* vel = OptionalColumn<FVelocity>(table);
+		for (auto i : it)
+		{
+			Grid.RefreshItem(chunk, table->entities[i], links[i], pos[i].pos,
+				vel ? vel[i].vel : FVector::ZeroVector, faction ? faction[i].faction : EFaction::Neutral);
+		}
+	});
 }
 
 void BoidSystem::schedule(ECSSystemScheduler* sysScheduler)
@@ -246,27 +291,106 @@ void BoidSystem::schedule(ECSSystemScheduler* sysScheduler)
 	init_query(q_ships, sysScheduler->registry);
 	init_query(q_projectiles, sysScheduler->registry);
 
-	TaskDependencies deps1;
-	deps1.AddRead < FPosition >();
-	deps1.AddWrite < FGridMap >();
+	//the faction and velocity are read from the table columns, they arent part of the grid query
+	TaskDependencies deps1 = TaskDependencies::FromQueries(q_grid);
+	deps1.AddRead < FFaction >();
+	deps1.AddRead < FVelocity >();
+
+	//the grid is updated in two parallel passes.
+	//A full build bins the rows of the query into a histogram per chunk, and once the histograms are merged into cells every chunk scatters its rows into place.
+	//An incremental update refreshes the rows that stayed in their cell in parallel, and then moves the rest on a single thread
+	TSharedRef<QueryChunks, ESPMode::ThreadSafe> split = MakeShared<QueryChunks, ESPMode::ThreadSafe>();
+	const int32 numChunks = sysScheduler->GetNumParallelChunks();
+	ecs_query_t* gridQuery = q_grid.c_ptr();
 
-	builder.AddTask(deps1,
+	builder.AddParallelTask(deps1,
 		[=](ECS_Registry& reg) {
-			UpdateGridmap(reg);
-	});
+			SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+			split->Start(gridQuery);
+
+			bFullGridBuild = ECSCVars::IncrementalGrid == 0 || Grid.NeedsFullBuild();
+			if (bFullGridBuild)
+			{
+				Grid.BeginBuild(split->totalRows, numChunks);
+			}
+			else
+			{
+				Grid.BeginUpdate(numChunks);
+			}
+		},
+		[=](ECS_Registry& reg, int32 chunk, int32 chunkCount) {
+			SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+			if (bFullGridBuild)
+			{
+				GatherGridChunk(*split, chunk, chunkCount);
+			}
+			else
+			{
+				RefreshGridChunk(*split, chunk, chunkCount);
+			}
+		});
+
+	//the moves write the FGridMap of the entities that get swapped around
+	TaskDependencies deps2 = TaskDependencies::FromQueries(q_grid);
+
+	builder.AddParallelTask(deps2,
+		[=](ECS_Registry& reg) {
+			SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+			if (bFullGridBuild)
+			{
+				Grid.MergeChunks();
+			}
+			else
+			{
+				Grid.ApplyMoves(reg);
+			}
+		},
+		[=](ECS_Registry& reg, int32 chunk, int32 chunkCount) {
+			if (!bFullGridBuild) return;
+
+			SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+			for (int32 c = chunk; c < Grid.GetNumBuildChunks(); c += chunkCount)
+			{
+				Grid.ScatterChunk(c);
+			}
+		});
+
+	//the far field needs the per faction summary of every cell, only when it is enabled
+	builder.AddParallelTask(TaskDependencies{},
+		[=](ECS_Registry& reg) {
+			OpeningAngle = FMath::Max(ECSCVars::BoidOpeningAngle, 0.f);
+			if (OpeningAngle > 0.f)
+			{
+				SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+				Grid.BeginSummaries();
+			}
+		},
+		[=](ECS_Registry& reg, int32 chunk, int32 chunkCount) {
+			if (OpeningAngle > 0.f)
+			{
+				SCOPE_CYCLE_COUNTER(STAT_GridmapUpdate);
+				Grid.SummarizeCells(chunk, chunkCount);
+			}
+		}, ESysTaskFlags::NoECS);
 	
 
-	TaskDependencies deps2;
-	deps2.AddWrite < FVelocity >();
-	deps2.AddRead < FGridMap >();	
-	deps2.AddRead < FSpaceship>();
-	deps2.AddRead <FPosition >();
-	deps2.AddRead < FProjectile>();
-	builder.AddTask(deps2,
+	//the boids run straight over the table columns of both queries, every chunk takes a slice of each
+	TaskDependencies deps3 = TaskDependencies::FromQueries(q_ships, q_projectiles);
+	TSharedRef<QueryChunks, ESPMode::ThreadSafe> projectileSplit = MakeShared<QueryChunks, ESPMode::ThreadSafe>();
+	TSharedRef<QueryChunks, ESPMode::ThreadSafe> shipSplit = MakeShared<QueryChunks, ESPMode::ThreadSafe>();
+	ecs_query_t* projectileQuery = q_projectiles.c_ptr();
+	ecs_query_t* shipQuery = q_ships.c_ptr();
+	const ECSWorldClock* clock = &World->Clock;
+
+	builder.AddParallelTask(deps3,
 		[=](ECS_Registry& reg) {
-			UpdateAllBoids(reg, 1.0/60.0);
-		}
-	);
+			projectileSplit->Start(projectileQuery);
+			shipSplit->Start(shipQuery);
+		},
+		[=](ECS_Registry& reg, int32 chunk, int32 chunkCount) {
+			SCOPE_CYCLE_COUNTER(STAT_Boids);
+			UpdateBoidsChunk(*projectileSplit, *shipSplit, chunk, chunkCount, clock->StepDeltaTime);
+		});
 
 	builder.AddDependency("CopyTransform");
 
@@ -277,48 +401,67 @@ void ExplosionSystem::update(ECS_Registry& registry, float dt)
 {
 }
 
+void ExplosionSystem::initialize(AActor* _Owner, ECS_World* _World)
+{
+	System::initialize(_Owner, _World);
+	Expiries.Reset(World->Clock.StepCount + 1);
+
+	//setting an explosion puts it on the wheel, a newer one makes the old timer get skipped
+	AddSetTrigger<FExplosion>([this](flecs::iter it, FExplosion* explosions) {
+		for (auto i : it)
+		{
+			ScheduleExpiry(it.entity(i).id(), explosions[i]);
+		}
+	});
+}
+
+void ExplosionSystem::ScheduleExpiry(EntityID Entity, FExplosion& Explosion)
+{
+	//the explosion ends on the step its live time goes past the duration
+	Explosion.ExpiryStep = World->Clock.StepAfter(Explosion.Duration - Explosion.LiveTime);
+	Expiries.Schedule(Entity, Explosion.ExpiryStep);
+}
+
 void ExplosionSystem::schedule(ECSSystemScheduler* sysScheduler)
 {
 	SystemTaskBuilder builder("Explosion", 200000, sysScheduler);
 
 	init_query(q_explosions, sysScheduler->registry);
+	init_query(q_explosion_scale, sysScheduler->registry);
 
-	float dt = 1.0 / 60.f;
-	TaskDependencies deps1;
+	ECSCommandQueue* commands = &World->Commands;
+	const ECSWorldClock* clock = &World->Clock;
 
-	//deps1.AddWrite < FDestroy > ();
-	deps1.AddWrite < FExplosion > ();
-	//builder.AddGameTask(deps1,
 	builder.AddDependency("Movement");
-	builder.AddSyncTask(//deps1,
-		[=](ECS_Registry& reg) {
+	builder.AddParallelForEach(q_explosions, TaskDependencies::FromQueries(q_explosions),
+		[clock](auto et, FExplosion& ex, FScale& s) {
+			ex.LiveTime += clock->StepDeltaTime;
+		});
+
+	//the explosions that end on this step are destroyed when the commands are applied
+	TaskDependencies expiryDeps;
+	expiryDeps.AddRead<FExplosion>();
+	builder.AddTask(expiryDeps,
+		[this, commands, clock](ECS_Registry& reg) {
 			SCOPE_CYCLE_COUNTER(STAT_Explosion);
+			ECSCommandBuffer& cmd = commands->GetThreadBuffer();
 
-			DeletionContext* del = DeletionContext::GetFromRegistry(reg);
+			Expiries.Advance(clock->StepCount, [&](const ECSTimerWheel::Timer& timer) {
+				flecs::entity e(reg, timer.Entity);
+				if (!e.is_alive()) return;
 
-			q_explosions.each([&](auto et, FExplosion& ex, FScale& s) {
-				ex.LiveTime += dt;
-				if (ex.LiveTime > ex.Duration)
+				const FExplosion* explosion = e.get<FExplosion>();
+				if (explosion && explosion->ExpiryStep == timer.Step)
 				{
-
-					del->AddToQueue(et.id());
+					cmd.Destroy(timer.Entity);
 				}
 			});
-		}
-	);
-
-	TaskDependencies deps;
-
-	deps.AddWrite < FScale > ();
-	deps.AddRead < FExplosion > ();
+		});
 
-	builder.AddTask(deps,
-		[=](ECS_Registry& reg) {
-			q_explosions.each([&](auto et, FExplosion& ex, FScale& s) {
-				s.scale = FVector((ex.LiveTime / ex.Duration) * ex.MaxScale);
-			});
-		}
-	);
+	builder.AddParallelForEach(q_explosion_scale, TaskDependencies::FromQueries(q_explosion_scale),
+		[](auto et, const FExplosion& ex, FScale& s) {
+			s.scale = FVector((ex.LiveTime / ex.Duration) * ex.MaxScale);
+		});
 
 	sysScheduler->AddTaskgraph(builder.FinishGraph());
 }
@@ -6,6 +6,10 @@
 #include "ECS_BattleComponents.h"
 
 #include "LinearMemory.h"
+#include "SpatialGrid.h"
+#include "TimerWheel.h"
+
+struct QueryChunks;
 
 DECLARE_CYCLE_STAT(TEXT("ECS: Explosion System"), STAT_Explosion, STATGROUP_ECS);
 
@@ -15,12 +19,20 @@ struct ExplosionSystem :public System {
 
 	float elapsed = 0;
 
+	//explosions keyed by the step they end on
+	ECSTimerWheel Expiries;
+
+	void initialize(AActor* _Owner, ECS_World* _World) override;
+
 	void update(ECS_Registry &registry, float dt) override;
 
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
+	void ScheduleExpiry(EntityID Entity, FExplosion& Explosion);
+
 	flecs::query <FExplosion, FScale> q_explosions;
+	flecs::query <const FExplosion, FScale> q_explosion_scale;
 };
 
 struct SpaceshipSystem :public System {
@@ -30,7 +42,7 @@ struct SpaceshipSystem :public System {
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
-	flecs::query<FSpaceship, FRotationComponent, FVelocity> q_ships;
+	flecs::query<const FSpaceship, FRotationComponent, const FVelocity> q_ships;
 };
 
 
@@ -40,84 +52,34 @@ struct BoidSystem :public System {
 
 	const float GRID_DIMENSION = 500.0;
 
-	struct GridItem {
-		EntityHandle ID;
-		FVector Position;
-		EFaction Faction;
-
-	};
-	struct ProjectileData {
-		//read only data
-		FProjectile proj;
-		FPosition pos;
-		FFaction faction;
-		//velocity is a pointer so it can be modified
-		FVelocity * vel;
-	};
-	struct SpaceshipData {
-
-		//read only data
-		FSpaceship ship;
-		FPosition pos;
-		FFaction  faction;
-
-		//velocity is a pointer so it can be modified
-		FVelocity * vel;
-	};
+	ECSSpatialGrid Grid{ GRID_DIMENSION };
+	//chosen at the start of every grid update, a full build or an incremental update
+	bool bFullGridBuild = true;
+	//far field opening angle of this step, 0 when the cells arent summarized
+	float OpeningAngle = 0.f;
 
-	
-	TMap<FIntVector, TArray<GridItem>> GridMap;
-
-	void AddToGridmap(flecs::entity ent, FPosition&pos);
-	void Foreach_EntitiesInRadius(float radius, FVector origin, TFunctionRef<void(GridItem&)> Body)
-	{
-		const float radSquared = radius * radius;
-		const FVector RadVector(radius, radius, radius);
-		const FIntVector GridLoc = FIntVector(origin / GRID_DIMENSION);
-		const FIntVector MinGrid = FIntVector((origin - RadVector) / GRID_DIMENSION);
-		const FIntVector MaxGrid = FIntVector((origin + RadVector) / GRID_DIMENSION);
-
-
-		for (int x = MinGrid.X; x <= MaxGrid.X; x++) {
-			for (int y = MinGrid.Y; y <= MaxGrid.Y; y++) {
-				for (int z = MinGrid.Z; z <= MaxGrid.Z; z++) {
-					const FIntVector SearchLoc(x, y, z);
-					const auto SearchGrid = GridMap.Find(SearchLoc);
-					if (SearchGrid)
-					{
-						for (auto e : *SearchGrid)
-						{
-							if (FVector::DistSquared(e.Position, origin) < radSquared)
-							{
-								Body(e);
-
-							}
-						}
-					}
-				}
-			}
-		}
-	}
+	void initialize(AActor* _Owner, ECS_World* _World) override;
 
 	void update(ECS_Registry &registry, float dt) override;
 
 	void UpdateAllBoids(ECS_Registry& registry, float dt);
+	//updates the rows of one chunk of each query, straight from the table columns.
+	//Projectiles and ships are split at once so every chunk gets some of both
+	void UpdateBoidsChunk(const QueryChunks& projectiles, const QueryChunks& ships, int32 chunk, int32 numChunks, float dt);
 
-	void update_projectile(ProjectileData& data, float dt);
-
-	
+	void update_projectile(const FProjectile& proj, const FPosition& pos, FVelocity& vel, const FFaction& faction, float dt);
 
-	void update_spaceship(SpaceshipData& data/*TypedLinearMemory<SpaceshipData> SpaceshipArray, int32 Index*/, float dt);
+	void update_spaceship(const FSpaceship& ship, const FPosition& pos, FVelocity& vel, const FFaction& faction, float dt);
 	void UpdateGridmap(ECS_Registry& registry);
+	//bins the rows of one chunk of q_grid into the grid
+	void GatherGridChunk(const QueryChunks& split, int32 chunk, int32 numChunks);
+	//refreshes the rows of one chunk of q_grid in place, and queues the ones that changed cell
+	void RefreshGridChunk(const QueryChunks& split, int32 chunk, int32 numChunks);
 
 
 	void schedule(ECSSystemScheduler* sysScheduler) override;
 
-	flecs::query <FGridMap, FPosition> q_grid;
-	flecs::query <FSpaceship, FPosition, FVelocity, FFaction> q_ships;
-	flecs::query<FProjectile, FPosition, FVelocity, FFaction > q_projectiles;
-
-	//temporal storage
-	TArray<ProjectileData> ProjArray;
-	TArray<SpaceshipData> SpaceshipArray;
+	flecs::query <FGridMap, const FPosition> q_grid;
+	flecs::query <const FSpaceship, const FPosition, FVelocity, const FFaction> q_ships;
+	flecs::query<const FProjectile, const FPosition, FVelocity, const FFaction > q_projectiles;
 };
\ No newline at end of file
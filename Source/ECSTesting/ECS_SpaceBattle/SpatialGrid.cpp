@@ -0,0 +1,586 @@
+#include "SpatialGrid.h"
+
+//steering of the items of one cell, one at a time. Stops once Remaining items were counted
+static FVector SumItemsScalar(const float* X, const float* Y, const float* Z, const EFaction* Factions, int32 Begin, int32 End,
+	const FVector& Origin, float RadSquared, EFaction Faction, bool bOtherFactions, float Strength, int32& Remaining)
+{
+	FVector Sum = FVector::ZeroVector;
+	for (int32 i = Begin; i < End && Remaining > 0; i++)
+	{
+		if ((Factions[i] != Faction) != bOtherFactions) continue;
+
+		const FVector Direction(X[i] - Origin.X, Y[i] - Origin.Y, Z[i] - Origin.Z);
+		const float DistSquared = Direction.SizeSquared();
+		if (DistSquared >= RadSquared || DistSquared < SMALL_NUMBER) continue;
+
+		const float Falloff = FMath::Clamp(1.f - DistSquared / RadSquared, 0.1f, 1.f);
+		Sum += Direction.GetSafeNormal() * (Strength * Falloff);
+		Remaining--;
+	}
+	return Sum;
+}
+
+void ECSSpatialGrid::BeginBuild(int32 NumItems, int32 NumChunks)
+{
+	StagedIDs.SetNumUninitialized(NumItems);
+	StagedLinks.SetNumUninitialized(NumItems);
+	StagedPositions.SetNumUninitialized(NumItems);
+	StagedVelocities.SetNumUninitialized(NumItems);
+	StagedFactions.SetNumUninitialized(NumItems);
+	StagedCells.SetNumUninitialized(NumItems);
+
+	//chunks keep their tables between builds, only the ones that get items are reset
+	Chunks.SetNum(NumChunks, false);
+	for (BuildChunk& chunk : Chunks)
+	{
+		chunk.Begin = 0;
+		chunk.End = 0;
+	}
+}
+
+void ECSSpatialGrid::BeginChunk(int32 Chunk, int32 Begin, int32 End)
+{
+	BuildChunk& chunk = Chunks[Chunk];
+	chunk.Begin = Begin;
+	chunk.End = End;
+	chunk.LocalCells.Reset(chunk.LocalCells.Locations.Num());
+	chunk.Counts.Reset();
+}
+
+void ECSSpatialGrid::SetItem(int32 Chunk, int32 Index, EntityID ID, FGridMap* Link, const FVector& Position, const FVector& Velocity, EFaction Faction)
+{
+	BuildChunk& chunk = Chunks[Chunk];
+
+	const int32 local = chunk.LocalCells.FindOrAdd(GetCellLocation(Position));
+	if (local == chunk.Counts.Num())
+	{
+		chunk.Counts.Add(0);
+	}
+	chunk.Counts[local]++;
+
+	StagedIDs[Index] = ID;
+	StagedLinks[Index] = Link;
+	StagedPositions[Index] = Position;
+	StagedVelocities[Index] = Velocity;
+	StagedFactions[Index] = Faction;
+	StagedCells[Index] = local;
+}
+
+void ECSSpatialGrid::MergeChunks()
+{
+	//the table is sized from the last build, most frames have about the same amount of cells
+	CellLookup.Reset(FMath::Max(Cells.Num(), 32));
+	Cells.Reset();
+
+	//count
+	for (BuildChunk& chunk : Chunks)
+	{
+		if (chunk.Begin == chunk.End) continue;
+
+		const int32 numLocal = chunk.Counts.Num();
+		chunk.GlobalCells.SetNumUninitialized(numLocal);
+		for (int32 l = 0; l < numLocal; l++)
+		{
+			const int32 c = FindOrAddCell(chunk.LocalCells.Locations[l]);
+			Cells[c].Count += chunk.Counts[l];
+			chunk.GlobalCells[l] = c;
+		}
+	}
+
+	//prefix sum, leaving some room after every cell
+	CellCursors.SetNumUninitialized(Cells.Num());
+	int32 start = 0;
+	for (int32 c = 0; c < Cells.Num(); c++)
+	{
+		Cells[c].Start = start;
+		Cells[c].Capacity = CellCapacity(Cells[c].Count);
+		CellCursors[c] = start;
+		start += Cells[c].Capacity;
+	}
+
+	X.SetNumUninitialized(start);
+	Y.SetNumUninitialized(start);
+	Z.SetNumUninitialized(start);
+	VX.SetNumUninitialized(start);
+	VY.SetNumUninitialized(start);
+	VZ.SetNumUninitialized(start);
+	Factions.SetNumUninitialized(start);
+	IDs.SetNumUninitialized(start);
+
+	//every chunk gets its own range inside each cell, in chunk order
+	for (BuildChunk& chunk : Chunks)
+	{
+		if (chunk.Begin == chunk.End) continue;
+
+		chunk.Cursors.SetNumUninitialized(chunk.Counts.Num());
+		for (int32 l = 0; l < chunk.Counts.Num(); l++)
+		{
+			const int32 c = chunk.GlobalCells[l];
+			chunk.Cursors[l] = CellCursors[c];
+			CellCursors[c] += chunk.Counts[l];
+		}
+	}
+
+	NumItems = StagedIDs.Num();
+	NumOccupiedCells = Cells.Num();
+	bBuilt = true;
+}
+
+void ECSSpatialGrid::ScatterChunk(int32 Chunk)
+{
+	BuildChunk& chunk = Chunks[Chunk];
+
+	for (int32 i = chunk.Begin; i < chunk.End; i++)
+	{
+		const int32 local = StagedCells[i];
+		const int32 dst = chunk.Cursors[local]++;
+		WriteItem(dst, StagedIDs[i], StagedPositions[i], StagedVelocities[i], StagedFactions[i]);
+
+		if (FGridMap* link = StagedLinks[i])
+		{
+			const Cell& cell = Cells[chunk.GlobalCells[local]];
+			link->GridLocation = cell.Location;
+			link->Cell = chunk.GlobalCells[local];
+			link->Slot = dst - cell.Start;
+		}
+	}
+}
+
+bool ECSSpatialGrid::NeedsFullBuild() const
+{
+	//holes come from cells that moved to grow, and cells that were left empty
+	return !bBuilt || X.Num() > NumItems * 3 + 1024 || Cells.Num() > NumOccupiedCells * 2 + 64;
+}
+
+void ECSSpatialGrid::BeginUpdate(int32 NumChunks)
+{
+	Chunks.SetNum(NumChunks, false);
+	for (BuildChunk& chunk : Chunks)
+	{
+		chunk.Moves.Reset();
+	}
+}
+
+void ECSSpatialGrid::RefreshItem(int32 Chunk, EntityID ID, FGridMap& Link, const FVector& Position, const FVector& Velocity, EFaction Faction)
+{
+	if (Link.Cell != INDEX_NONE && GetCellLocation(Position) == Link.GridLocation)
+	{
+		const Cell& cell = Cells[Link.Cell];
+		checkSlow(Link.Slot < cell.Count && IDs[cell.Start + Link.Slot] == ID);
+
+		WriteItem(cell.Start + Link.Slot, ID, Position, Velocity, Faction);
+	}
+	else
+	{
+		Chunks[Chunk].Moves.Add({ ID, &Link, Position, Velocity, Faction });
+	}
+}
+
+void ECSSpatialGrid::ApplyMoves(ECS_Registry& registry)
+{
+	for (BuildChunk& chunk : Chunks)
+	{
+		for (const PendingMove& move : chunk.Moves)
+		{
+			FGridMap& link = *move.Link;
+			if (link.Cell != INDEX_NONE)
+			{
+				RemoveItem(registry, link);
+			}
+
+			const int32 c = FindOrAddCell(GetCellLocation(move.Position));
+			if (Cells[c].Count == Cells[c].Capacity)
+			{
+				GrowCell(c);
+			}
+
+			Cell& cell = Cells[c];
+			if (cell.Count == 0)
+			{
+				NumOccupiedCells++;
+			}
+			const int32 slot = cell.Count++;
+			WriteItem(cell.Start + slot, move.ID, move.Position, move.Velocity, move.Faction);
+			NumItems++;
+
+			link.GridLocation = cell.Location;
+			link.Cell = c;
+			link.Slot = slot;
+		}
+		chunk.Moves.Reset();
+	}
+}
+
+void ECSSpatialGrid::RemoveItem(ECS_Registry& registry, FGridMap& Link)
+{
+	Cell& cell = Cells[Link.Cell];
+	const int32 last = cell.Count - 1;
+
+	if (Link.Slot != last)
+	{
+		const int32 dst = cell.Start + Link.Slot;
+		const int32 src = cell.Start + last;
+		WriteItem(dst, IDs[src], GetPosition(src), GetVelocity(src), Factions[src]);
+
+		if (FGridMap* moved = FindLink(registry, IDs[dst]))
+		{
+			moved->Slot = Link.Slot;
+		}
+	}
+
+	cell.Count--;
+	NumItems--;
+	if (cell.Count == 0)
+	{
+		NumOccupiedCells--;
+	}
+
+	Link.Cell = INDEX_NONE;
+	Link.Slot = INDEX_NONE;
+}
+
+int32 ECSSpatialGrid::FindOrAddCell(const FIntVector& Location)
+{
+	const int32 c = CellLookup.FindOrAdd(Location);
+	if (c == Cells.Num())
+	{
+		Cells.Add({ Location, 0, 0, 0 });
+	}
+	return c;
+}
+
+void ECSSpatialGrid::GrowCell(int32 CellIndex)
+{
+	Cell& cell = Cells[CellIndex];
+	const int32 newStart = X.Num();
+	const int32 newCapacity = FMath::Max(cell.Capacity * 2, 8);
+
+	X.AddUninitialized(newCapacity);
+	Y.AddUninitialized(newCapacity);
+	Z.AddUninitialized(newCapacity);
+	VX.AddUninitialized(newCapacity);
+	VY.AddUninitialized(newCapacity);
+	VZ.AddUninitialized(newCapacity);
+	Factions.AddUninitialized(newCapacity);
+	IDs.AddUninitialized(newCapacity);
+
+	for (int32 i = 0; i < cell.Count; i++)
+	{
+		const int32 src = cell.Start + i;
+		WriteItem(newStart + i, IDs[src], GetPosition(src), GetVelocity(src), Factions[src]);
+	}
+
+	cell.Start = newStart;
+	cell.Capacity = newCapacity;
+}
+
+void ECSSpatialGrid::WriteItem(int32 Index, EntityID ID, const FVector& Position, const FVector& Velocity, EFaction Faction)
+{
+	X[Index] = Position.X;
+	Y[Index] = Position.Y;
+	Z[Index] = Position.Z;
+	VX[Index] = Velocity.X;
+	VY[Index] = Velocity.Y;
+	VZ[Index] = Velocity.Z;
+	Factions[Index] = Faction;
+	IDs[Index] = ID;
+}
+
+FGridMap* ECSSpatialGrid::FindLink(ECS_Registry& registry, EntityID ID)
+{
+	//the grid owns the link, it is written in place instead of through a set that would notify flecs
+	return const_cast<FGridMap*>(flecs::entity(registry, ID).get<FGridMap>());
+}
+
+void ECSSpatialGrid::BeginSummaries()
+{
+	Summaries.SetNumUninitialized(Cells.Num() * NumFactions);
+}
+
+void ECSSpatialGrid::SummarizeCells(int32 Chunk, int32 NumChunks)
+{
+	const int32 begin = int32(int64(Cells.Num()) * Chunk / NumChunks);
+	const int32 end = int32(int64(Cells.Num()) * (Chunk + 1) / NumChunks);
+
+	for (int32 c = begin; c < end; c++)
+	{
+		const Cell& cell = Cells[c];
+
+		int32 Counts[NumFactions] = {};
+		FVector PositionSums[NumFactions] = { FVector::ZeroVector, FVector::ZeroVector, FVector::ZeroVector };
+		FVector VelocitySums[NumFactions] = { FVector::ZeroVector, FVector::ZeroVector, FVector::ZeroVector };
+
+		for (int32 i = cell.Start; i < cell.Start + cell.Count; i++)
+		{
+			const int32 f = int32(Factions[i]);
+			Counts[f]++;
+			PositionSums[f] += GetPosition(i);
+			VelocitySums[f] += GetVelocity(i);
+		}
+
+		for (int32 f = 0; f < NumFactions; f++)
+		{
+			CellSummary& summary = Summaries[c * NumFactions + f];
+			summary.Count = Counts[f];
+			summary.Centroid = Counts[f] > 0 ? PositionSums[f] / Counts[f] : FVector::ZeroVector;
+			summary.AverageVelocity = Counts[f] > 0 ? VelocitySums[f] / Counts[f] : FVector::ZeroVector;
+		}
+	}
+}
+
+FVector ECSSpatialGrid::SumSteering(const SteeringQuery& Query) const
+{
+	const FVector& Origin = Query.Origin;
+	const EFaction Faction = Query.Faction;
+	const bool bOtherFactions = Query.bOtherFactions;
+	const float Strength = Query.Strength;
+	const float RadSquared = Query.Radius * Query.Radius;
+
+	int32 Remaining = Query.MaxNeighbours > 0 ? Query.MaxNeighbours : MAX_int32;
+	FVector Sum = FVector::ZeroVector;
+
+	//cells that the sphere only overlaps through the corners of their box are skipped.
+	//With a neighbour cap the cells are visited closest first, so the items that get counted are close to the nearest ones
+	struct VisitCell {
+		float DistSquared;
+		const Cell* SearchCell;
+	};
+	TArray<VisitCell, TInlineAllocator<32>> VisitCells;
+	ForEachCellInRadius(Origin, Query.Radius, [&](const Cell& SearchCell) {
+		const FVector BoxMin = FVector(SearchCell.Location) * CellSize;
+		const FBox CellBox(BoxMin, BoxMin + FVector(CellSize));
+		const float DistSquared = CellBox.ComputeSquaredDistanceToPoint(Origin);
+		if (DistSquared < RadSquared)
+		{
+			VisitCells.Add({ DistSquared, &SearchCell });
+		}
+	});
+	if (Query.MaxNeighbours > 0)
+	{
+		VisitCells.Sort([](const VisitCell& A, const VisitCell& B) { return A.DistSquared < B.DistSquared; });
+	}
+
+	//a far cell adds its summaries to the sum and returns true, so the item loops skip it
+	const float OpeningSquared = Query.OpeningAngle * Query.OpeningAngle;
+	const FIntVector OriginCell = GetCellLocation(Origin);
+	auto AddIfFarCell = [&](const Cell& SearchCell) {
+		//the cell of the origin is always done item by item, no matter the angle
+		if (Query.OpeningAngle <= 0.f || SearchCell.Location == OriginCell) return false;
+
+		const FVector Center = (FVector(SearchCell.Location) + FVector(0.5f)) * CellSize;
+		if (CellSize * CellSize >= OpeningSquared * FVector::DistSquared(Center, Origin)) return false;
+
+		for (int32 f = 0; f < NumFactions && Remaining > 0; f++)
+		{
+			if ((EFaction(f) != Faction) != bOtherFactions) continue;
+
+			const CellSummary& summary = GetSummary(SearchCell, EFaction(f));
+			if (summary.Count == 0) continue;
+
+			const FVector Direction = summary.Centroid - Origin;
+			const float DistSquared = Direction.SizeSquared();
+			if (DistSquared >= RadSquared || DistSquared < SMALL_NUMBER) continue;
+
+			//with a cap, the summary only stands for as many items as there is room for
+			const int32 Count = FMath::Min(summary.Count, Remaining);
+			Remaining -= Count;
+
+			const float Falloff = FMath::Clamp(1.f - DistSquared / RadSquared, 0.1f, 1.f);
+			Sum += Direction.GetSafeNormal() * (Strength * Falloff * Count);
+		}
+		return true;
+	};
+
+#if !PLATFORM_ENABLE_VECTORINTRINSICS
+	for (const VisitCell& visit : VisitCells)
+	{
+		if (Remaining <= 0) break;
+		if (AddIfFarCell(*visit.SearchCell)) continue;
+
+		Sum += SumItemsScalar(X.GetData(), Y.GetData(), Z.GetData(), Factions.GetData(), visit.SearchCell->Start, visit.SearchCell->Start + visit.SearchCell->Count,
+			Origin, RadSquared, Faction, bOtherFactions, Strength, Remaining);
+	}
+#else
+
+	const VectorRegister OriginX = VectorSetFloat1(Origin.X);
+	const VectorRegister OriginY = VectorSetFloat1(Origin.Y);
+	const VectorRegister OriginZ = VectorSetFloat1(Origin.Z);
+	const VectorRegister RadSq = VectorSetFloat1(RadSquared);
+	const VectorRegister InvRadSq = VectorSetFloat1(1.f / RadSquared);
+	const VectorRegister MinFalloff = VectorSetFloat1(0.1f);
+	const VectorRegister MinDistSq = VectorSetFloat1(SMALL_NUMBER);
+	const VectorRegister StrengthV = VectorSetFloat1(Strength);
+
+	//every lane keeps its own sum, they get added together at the end
+	VectorRegister SumX = VectorZero();
+	VectorRegister SumY = VectorZero();
+	VectorRegister SumZ = VectorZero();
+
+	for (const VisitCell& visit : VisitCells)
+	{
+		if (Remaining <= 0) break;
+
+		const Cell& SearchCell = *visit.SearchCell;
+		if (AddIfFarCell(SearchCell)) continue;
+
+		const int32 end = SearchCell.Start + SearchCell.Count;
+		int32 i = SearchCell.Start;
+
+		for (; i + 4 <= end && Remaining > 0; i += 4)
+		{
+			const VectorRegister DX = VectorSubtract(VectorLoad(&X[i]), OriginX);
+			const VectorRegister DY = VectorSubtract(VectorLoad(&Y[i]), OriginY);
+			const VectorRegister DZ = VectorSubtract(VectorLoad(&Z[i]), OriginZ);
+			const VectorRegister DistSq = VectorMultiplyAdd(DZ, DZ, VectorMultiplyAdd(DY, DY, VectorMultiply(DX, DX)));
+
+			//in range, not on top of the origin, and of a matching faction
+			const VectorRegister FactionMask = MakeVectorRegister(
+				(Factions[i] != Faction) == bOtherFactions ? 0xFFFFFFFFu : 0u,
+				(Factions[i + 1] != Faction) == bOtherFactions ? 0xFFFFFFFFu : 0u,
+				(Factions[i + 2] != Faction) == bOtherFactions ? 0xFFFFFFFFu : 0u,
+				(Factions[i + 3] != Faction) == bOtherFactions ? 0xFFFFFFFFu : 0u);
+			VectorRegister Mask = VectorBitwiseAnd(VectorBitwiseAnd(VectorCompareGT(RadSq, DistSq), VectorCompareGE(DistSq, MinDistSq)), FactionMask);
+
+			//count the lanes that pass, dropping the last ones if they go over the cap
+			uint32 LaneBits = VectorMaskBits(Mask);
+			int32 NumLanes = FMath::CountBits(LaneBits);
+			if (NumLanes > Remaining)
+			{
+				while (NumLanes > Remaining)
+				{
+					LaneBits &= ~(1u << FMath::FloorLog2(LaneBits));
+					NumLanes--;
+				}
+				Mask = MakeVectorRegister(
+					(LaneBits & 1) ? 0xFFFFFFFFu : 0u,
+					(LaneBits & 2) ? 0xFFFFFFFFu : 0u,
+					(LaneBits & 4) ? 0xFFFFFFFFu : 0u,
+					(LaneBits & 8) ? 0xFFFFFFFFu : 0u);
+			}
+			Remaining -= NumLanes;
+
+			const VectorRegister Falloff = VectorMin(VectorMax(VectorSubtract(VectorOne(), VectorMultiply(DistSq, InvRadSq)), MinFalloff), VectorOne());
+			//the masked out lanes can be inf or nan here, the mask clears them to 0
+			const VectorRegister Scale = VectorBitwiseAnd(VectorMultiply(VectorMultiply(Falloff, StrengthV), VectorReciprocalSqrtAccurate(DistSq)), Mask);
+
+			SumX = VectorMultiplyAdd(DX, Scale, SumX);
+			SumY = VectorMultiplyAdd(DY, Scale, SumY);
+			SumZ = VectorMultiplyAdd(DZ, Scale, SumZ);
+		}
+
+		if (i < end && Remaining > 0)
+		{
+			Sum += SumItemsScalar(X.GetData(), Y.GetData(), Z.GetData(), Factions.GetData(), i, end,
+				Origin, RadSquared, Faction, bOtherFactions, Strength, Remaining);
+		}
+	}
+
+	MS_ALIGN(16) float Lanes[3][4] GCC_ALIGN(16);
+	VectorStoreAligned(SumX, Lanes[0]);
+	VectorStoreAligned(SumY, Lanes[1]);
+	VectorStoreAligned(SumZ, Lanes[2]);
+
+	Sum.X += Lanes[0][0] + Lanes[0][1] + Lanes[0][2] + Lanes[0][3];
+	Sum.Y += Lanes[1][0] + Lanes[1][1] + Lanes[1][2] + Lanes[1][3];
+	Sum.Z += Lanes[2][0] + Lanes[2][1] + Lanes[2][2] + Lanes[2][3];
+#endif
+	return Sum;
+}
+
+FVector ECSSpatialGrid::SumSteeringScalar(const SteeringQuery& Query) const
+{
+	const float RadSquared = Query.Radius * Query.Radius;
+	int32 Remaining = MAX_int32;
+
+	FVector Sum = FVector::ZeroVector;
+	ForEachCellInRadius(Query.Origin, Query.Radius, [&](const Cell& SearchCell) {
+		Sum += SumItemsScalar(X.GetData(), Y.GetData(), Z.GetData(), Factions.GetData(), SearchCell.Start, SearchCell.Start + SearchCell.Count,
+			Query.Origin, RadSquared, Query.Faction, Query.bOtherFactions, Query.Strength, Remaining);
+	});
+	return Sum;
+}
+
+FVector ECSSpatialGrid::ReferenceSteering(const SteeringQuery& Query) const
+{
+	const FVector& Origin = Query.Origin;
+	const float Radius = Query.Radius;
+
+	FVector Steering = FVector::ZeroVector;
+	ForEachInRadius(Origin, Radius, [&](int32 item) {
+
+		if ((GetFaction(item) != Query.Faction) == Query.bOtherFactions)
+		{
+			const FVector TestPosition = GetPosition(item);
+
+			const float DistSquared = FVector::DistSquared(TestPosition, Origin);
+
+			const float AvoidanceDistance = Radius * Radius;
+			const float DistStrenght = FMath::Clamp(1.0 - (DistSquared / (AvoidanceDistance)), 0.1, 1.0);
+			const FVector Direction = TestPosition - Origin;
+
+			Steering += Direction.GetSafeNormal() * Query.Strength * DistStrenght;
+		}
+	});
+	return Steering;
+}
+
+void ECSSpatialGrid::CellTable::Reset(int32 expectedCells)
+{
+	Locations.Reset();
+	Resize(FMath::Max(expectedCells, 8));
+}
+
+int32 ECSSpatialGrid::CellTable::Find(const FIntVector& Location) const
+{
+	if (Slots.Num() == 0) return INDEX_NONE;
+
+	const uint32 mask = Slots.Num() - 1;
+	for (uint32 slot = Hash(Location) & mask;; slot = (slot + 1) & mask)
+	{
+		const int32 c = Slots[slot];
+		if (c == INDEX_NONE) return INDEX_NONE;
+		if (Locations[c] == Location) return c;
+	}
+}
+
+int32 ECSSpatialGrid::CellTable::FindOrAdd(const FIntVector& Location)
+{
+	//keep the load under half so the probes stay short
+	if ((Locations.Num() + 1) * 2 > Slots.Num())
+	{
+		Resize(Locations.Num() + 1);
+	}
+
+	const uint32 mask = Slots.Num() - 1;
+	uint32 slot = Hash(Location) & mask;
+	for (;; slot = (slot + 1) & mask)
+	{
+		const int32 c = Slots[slot];
+		if (c == INDEX_NONE) break;
+		if (Locations[c] == Location) return c;
+	}
+
+	Slots[slot] = Locations.Add(Location);
+	return Slots[slot];
+}
+
+void ECSSpatialGrid::CellTable::Resize(int32 numCells)
+{
+	const int32 size = FMath::RoundUpToPowerOfTwo(numCells * 2);
+	if (size > Slots.Num())
+	{
+		Slots.SetNumUninitialized(size);
+	}
+	FMemory::Memset(Slots.GetData(), 0xFF, Slots.Num() * sizeof(int32));
+
+	const uint32 mask = Slots.Num() - 1;
+	for (int32 c = 0; c < Locations.Num(); c++)
+	{
+		uint32 slot = Hash(Locations[c]) & mask;
+		while (Slots[slot] != INDEX_NONE)
+		{
+			slot = (slot + 1) & mask;
+		}
+		Slots[slot] = c;
+	}
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include "CoreMinimal.h"
+#include "ECS_Core.h"
+#include "ECS_BaseComponents.h"
+#include "ECS_BattleComponents.h"
+
+//Uniform grid packed into flat arrays. The items of a cell are next to each other, stored as structure of arrays,
+//and the cells are found through an open addressing hash table.
+//Every cell owns a range of the arrays with some room to grow. Items can move between cells one at a time,
+//and a cell that runs out of room is moved to the end of the arrays. A full build packs everything again.
+//
+//The full build is split in chunks that can run on different threads. Every chunk bins its own range of items into a local histogram,
+//the histograms are merged into the cells on a single thread, and then every chunk scatters its items into place.
+//A build with a single chunk is the serial version.
+//
+//The FGridMap of an item links it to its cell and slot, the grid keeps the links up to date.
+class ECSSpatialGrid {
+public:
+	struct Cell {
+		FIntVector Location;
+		//first item of the cell in the packed arrays
+		int32 Start;
+		int32 Count;
+		//size of the range the cell owns
+		int32 Capacity;
+	};
+
+	explicit ECSSpatialGrid(float _cellSize) : CellSize(_cellSize), InvCellSize(1.f / _cellSize) {}
+
+	//empties the grid and makes room for the items. Chunks that dont get any item are fine
+	void BeginBuild(int32 NumItems, int32 NumChunks);
+
+	//the range of items the chunk is going to set, has to be called before setting them
+	void BeginChunk(int32 Chunk, int32 Begin, int32 End);
+	//the link can be null, for items that dont need to be updated incrementally
+	void SetItem(int32 Chunk, int32 Index, EntityID ID, FGridMap* Link, const FVector& Position, const FVector& Velocity, EFaction Faction);
+
+	//single thread, builds the cells from the histograms of every chunk
+	void MergeChunks();
+
+	//writes the items of the chunk into their cells. Any number of chunks can scatter at once
+	void ScatterChunk(int32 Chunk);
+
+	int32 GetNumBuildChunks() const { return Chunks.Num(); }
+
+	//true when the grid was never built, or the incremental updates left too many holes in it
+	bool NeedsFullBuild() const;
+
+	//starts an incremental update, the chunks refresh the items in place and defer the ones that left their cell
+	void BeginUpdate(int32 NumChunks);
+	//refreshes the position of the item if it is still in the cell of its link, otherwise queues it for ApplyMoves.
+	//Any number of chunks can refresh at once, as long as each item is only refreshed once
+	void RefreshItem(int32 Chunk, EntityID ID, FGridMap& Link, const FVector& Position, const FVector& Velocity, EFaction Faction);
+	//single thread, moves the items that changed cell
+	void ApplyMoves(ECS_Registry& registry);
+
+	//single thread. Removes the item from its cell, the last item of the cell takes its slot
+	void RemoveItem(ECS_Registry& registry, FGridMap& Link);
+
+	//the items of a cell that belong to one faction, seen from far away
+	struct CellSummary {
+		int32 Count;
+		FVector Centroid;
+		FVector AverageVelocity;
+	};
+	static constexpr int32 NumFactions = 3;
+
+	//makes room for the summaries of every cell, has to run after the grid is updated and before SummarizeCells
+	void BeginSummaries();
+	//summarizes a range of the cells, any number of chunks can run at once
+	void SummarizeCells(int32 Chunk, int32 NumChunks);
+	const CellSummary& GetSummary(const Cell& SummaryCell, EFaction Faction) const {
+		return Summaries[int32(&SummaryCell - Cells.GetData()) * NumFactions + int32(Faction)];
+	}
+
+	FIntVector GetCellLocation(const FVector& Position) const {
+		return FIntVector(FMath::FloorToInt(Position.X * InvCellSize), FMath::FloorToInt(Position.Y * InvCellSize), FMath::FloorToInt(Position.Z * InvCellSize));
+	}
+
+	const Cell* FindCell(const FIntVector& Location) const {
+		const int32 index = CellLookup.Find(Location);
+		return index != INDEX_NONE ? &Cells[index] : nullptr;
+	}
+
+	//calls Body with every non empty cell that overlaps the box around the sphere
+	template<typename Func>
+	void ForEachCellInRadius(const FVector& Origin, float Radius, Func&& Body) const {
+		const FVector RadVector(Radius, Radius, Radius);
+		const FIntVector MinGrid = GetCellLocation(Origin - RadVector);
+		const FIntVector MaxGrid = GetCellLocation(Origin + RadVector);
+
+		for (int32 x = MinGrid.X; x <= MaxGrid.X; x++) {
+			for (int32 y = MinGrid.Y; y <= MaxGrid.Y; y++) {
+				for (int32 z = MinGrid.Z; z <= MaxGrid.Z; z++) {
+					const Cell* SearchCell = FindCell(FIntVector(x, y, z));
+					if (SearchCell && SearchCell->Count > 0) {
+						Body(*SearchCell);
+					}
+				}
+			}
+		}
+	}
+
+	//calls Body with the index of every item closer than radius to the origin
+	template<typename Func>
+	void ForEachInRadius(const FVector& Origin, float Radius, Func&& Body) const {
+		const float radSquared = Radius * Radius;
+
+		ForEachCellInRadius(Origin, Radius, [&](const Cell& SearchCell) {
+			const int32 end = SearchCell.Start + SearchCell.Count;
+			for (int32 i = SearchCell.Start; i < end; i++) {
+				const float dx = X[i] - Origin.X;
+				const float dy = Y[i] - Origin.Y;
+				const float dz = Z[i] - Origin.Z;
+				if (dx * dx + dy * dy + dz * dz < radSquared) {
+					Body(i);
+				}
+			}
+		});
+	}
+
+	struct SteeringQuery {
+		FVector Origin;
+		float Radius;
+		EFaction Faction;
+		//match the items that arent of the faction instead of the ones that are
+		bool bOtherFactions;
+		float Strength;
+		//far field, see SumSteering. 0 does every item one by one
+		float OpeningAngle{ 0.f };
+		//most matching items that get counted, 0 for no limit
+		int32 MaxNeighbours{ 0 };
+	};
+
+	//Sum of the directions from the origin to the matching items closer than radius. Each direction is scaled by strength
+	//and by a falloff that goes from 1 at the origin to 0.1 at the radius. Items on top of the origin have no direction and dont count.
+	//Runs 4 items at a time on the vector unit, platforms without vector intrinsics run it one item at a time.
+	//
+	//With an opening angle above 0, a cell that looks smaller than the angle from the origin (cell size / distance to its center)
+	//counts as all its matching items sitting on their centroid, through the cell summaries. Bigger angles are faster and less accurate.
+	//The summaries have to be up to date for that.
+	//
+	//With a neighbour cap the cells are visited from the closest one out, and the query stops as soon as the cap is reached.
+	//The items counted are the first ones found in that order, which are close to the nearest but not sorted inside a cell
+	FVector SumSteering(const SteeringQuery& Query) const;
+
+	//SumSteering one item at a time on every platform, without far field or neighbour cap
+	FVector SumSteeringScalar(const SteeringQuery& Query) const;
+	//the boid steering as it was before the vector kernel, item by item. Only used to check the kernel,
+	//the far field and the neighbour cap are ignored
+	FVector ReferenceSteering(const SteeringQuery& Query) const;
+
+	int32 Num() const { return NumItems; }
+	float GetCellSize() const { return CellSize; }
+	//cells can be empty after incremental updates
+	TArrayView<const Cell> GetCells() const { return Cells; }
+
+	FVector GetPosition(int32 Index) const { return FVector(X[Index], Y[Index], Z[Index]); }
+	FVector GetVelocity(int32 Index) const { return FVector(VX[Index], VY[Index], VZ[Index]); }
+	EFaction GetFaction(int32 Index) const { return Factions[Index]; }
+	EntityID GetID(int32 Index) const { return IDs[Index]; }
+
+private:
+	//open addressing hash table with linear probing, maps a cell location to the order it was added in
+	struct CellTable {
+		TArray<FIntVector> Locations;
+		//holds indices into Locations. Size is a power of two
+		TArray<int32> Slots;
+
+		//empties the table, sized for about expectedCells
+		void Reset(int32 expectedCells);
+		int32 Find(const FIntVector& Location) const;
+		int32 FindOrAdd(const FIntVector& Location);
+
+	private:
+		static uint32 Hash(const FIntVector& Location) {
+			return uint32(Location.X) * 73856093u ^ uint32(Location.Y) * 19349663u ^ uint32(Location.Z) * 83492791u;
+		}
+		//resizes the slots to hold at least numCells at half load, and reinserts the locations
+		void Resize(int32 numCells);
+	};
+
+	//item that left its cell during an incremental update
+	struct PendingMove {
+		EntityID ID;
+		FGridMap* Link;
+		FVector Position;
+		FVector Velocity;
+		EFaction Faction;
+	};
+
+	struct BuildChunk {
+		int32 Begin{ 0 };
+		int32 End{ 0 };
+		//cells touched by the chunk, with how many of its items land in each
+		CellTable LocalCells;
+		TArray<int32> Counts;
+		//global cell of each local cell, and where its next item gets written. Filled by the merge
+		TArray<int32> GlobalCells;
+		TArray<int32> Cursors;
+
+		TArray<PendingMove> Moves;
+	};
+
+	//room a cell gets on top of its items, so items can move in without moving the cell
+	static int32 CellCapacity(int32 Count) {
+		return Count + Count / 4 + 2;
+	}
+
+	//adds the cell if it doesnt exist, empty and without room
+	int32 FindOrAddCell(const FIntVector& Location);
+	//moves the cell to the end of the arrays with double the room
+	void GrowCell(int32 CellIndex);
+	void WriteItem(int32 Index, EntityID ID, const FVector& Position, const FVector& Velocity, EFaction Faction);
+	static FGridMap* FindLink(ECS_Registry& registry, EntityID ID);
+
+	float CellSize;
+	float InvCellSize;
+
+	//items as they were set, before binning
+	TArray<EntityID> StagedIDs;
+	TArray<FGridMap*> StagedLinks;
+	TArray<FVector> StagedPositions;
+	TArray<FVector> StagedVelocities;
+	TArray<EFaction> StagedFactions;
+	//local cell of every item, in the table of its chunk
+	TArray<int32> StagedCells;
+
+	TArray<BuildChunk> Chunks;
+
+	//packed items, sorted by cell. Slots past the count of a cell are garbage
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+	TArray<float> VX;
+	TArray<float> VY;
+	TArray<float> VZ;
+	TArray<EFaction> Factions;
+	TArray<EntityID> IDs;
+
+	TArray<Cell> Cells;
+	//same order as Cells
+	CellTable CellLookup;
+	//write cursor of each cell during the merge
+	TArray<int32> CellCursors;
+	//NumFactions per cell, in the order of the cells
+	TArray<CellSummary> Summaries;
+
+	int32 NumItems{ 0 };
+	int32 NumOccupiedCells{ 0 };
+	bool bBuilt{ false };
+};
@@ -0,0 +1,108 @@
+#include "SpatialGrid.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FECSSpatialGridSteeringTest, "ECS.SpatialGrid.SumSteering",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+//checks the boid steering kernel, vector and scalar, against the item by item reference
+bool FECSSpatialGridSteeringTest::RunTest(const FString& Parameters)
+{
+	const float CellSize = 200.f;
+	const float Radius = 300.f;
+	FRandomStream Random(1234);
+
+	//whole numbers, so the items placed at the radius are exactly at it
+	const FVector Origins[] = { FVector(0.f, 0.f, 0.f), FVector(130.f, -70.f, 410.f), FVector(-900.f, 600.f, -250.f) };
+
+	struct TestItem {
+		FVector Position;
+		EFaction Faction;
+	};
+	TArray<TestItem> Items;
+	auto RandomFaction = [&]() { return EFaction(Random.RandRange(0, ECSSpatialGrid::NumFactions - 1)); };
+
+	for (const FVector& Origin : Origins)
+	{
+		//on top of the origin, with no direction
+		for (int32 f = 0; f < ECSSpatialGrid::NumFactions; f++)
+		{
+			Items.Add({ Origin, EFaction(f) });
+		}
+
+		//exactly at the radius, which is out of range
+		const FVector Axes[] = { FVector(1.f, 0.f, 0.f), FVector(-1.f, 0.f, 0.f), FVector(0.f, 1.f, 0.f), FVector(0.f, -1.f, 0.f), FVector(0.f, 0.f, 1.f), FVector(0.f, 0.f, -1.f) };
+		for (int32 a = 0; a < UE_ARRAY_COUNT(Axes); a++)
+		{
+			Items.Add({ Origin + Axes[a] * Radius, EFaction(a % ECSSpatialGrid::NumFactions) });
+		}
+
+		//cells with 1 to 9 items, most of them with a tail the kernel does one by one
+		for (int32 Count = 1; Count <= 9; Count++)
+		{
+			const FIntVector Location(FMath::FloorToInt(Origin.X / CellSize) + Count % 3 - 1, FMath::FloorToInt(Origin.Y / CellSize) + Count / 3 - 1, FMath::FloorToInt(Origin.Z / CellSize) + 2);
+			const FVector BoxMin = FVector(Location) * CellSize;
+			for (int32 i = 0; i < Count; i++)
+			{
+				const FVector Offset(Random.FRandRange(1.f, CellSize - 1.f), Random.FRandRange(1.f, CellSize - 1.f), Random.FRandRange(1.f, CellSize - 1.f));
+				Items.Add({ BoxMin + Offset, RandomFaction() });
+			}
+		}
+
+		for (int32 i = 0; i < 300; i++)
+		{
+			Items.Add({ Origin + Random.GetUnitVector() * Random.FRandRange(0.f, Radius * 1.5f), RandomFaction() });
+		}
+	}
+
+	ECSSpatialGrid Grid(CellSize);
+	Grid.BeginBuild(Items.Num(), 1);
+	Grid.BeginChunk(0, 0, Items.Num());
+	for (int32 i = 0; i < Items.Num(); i++)
+	{
+		Grid.SetItem(0, i, EntityID(i + 1), nullptr, Items[i].Position, FVector::ZeroVector, Items[i].Faction);
+	}
+	Grid.MergeChunks();
+	Grid.ScatterChunk(0);
+
+	TArray<FVector> QueryOrigins(Origins, UE_ARRAY_COUNT(Origins));
+	for (int32 i = 0; i < 20; i++)
+	{
+		QueryOrigins.Add(Origins[i % UE_ARRAY_COUNT(Origins)] + Random.GetUnitVector() * Random.FRandRange(0.f, Radius));
+	}
+
+	for (const FVector& Origin : QueryOrigins)
+	{
+		for (int32 f = 0; f < ECSSpatialGrid::NumFactions; f++)
+		{
+			for (const bool bOtherFactions : { false, true })
+			{
+				const float Strength = bOtherFactions ? 2.5f : -0.75f;
+				const ECSSpatialGrid::SteeringQuery Query{ Origin, Radius, EFaction(f), bOtherFactions, Strength };
+
+				const FVector Reference = Grid.ReferenceSteering(Query);
+				//same tolerance as p.ECSValidateBoidKernel, the kernels add in a different order and use a faster inverse square root
+				const float Tolerance = 1e-3f * FMath::Max(Reference.Size(), FMath::Abs(Strength));
+
+				const FVector Vector = Grid.SumSteering(Query);
+				if (!Vector.Equals(Reference, Tolerance))
+				{
+					AddError(FString::Printf(TEXT("SumSteering at %s, faction %d, other factions %d: %s, reference %s"),
+						*Origin.ToString(), f, int32(bOtherFactions), *Vector.ToString(), *Reference.ToString()));
+				}
+
+				const FVector Scalar = Grid.SumSteeringScalar(Query);
+				if (!Scalar.Equals(Reference, Tolerance))
+				{
+					AddError(FString::Printf(TEXT("SumSteeringScalar at %s, faction %d, other factions %d: %s, reference %s"),
+						*Origin.ToString(), f, int32(bOtherFactions), *Scalar.ToString(), *Reference.ToString()));
+				}
+			}
+		}
+	}
+
+	return !HasAnyErrors();
+}
+
+#endif